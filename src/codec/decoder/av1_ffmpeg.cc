@@ -0,0 +1,41 @@
+#include "av1_ffmpeg.hh"
+#include "logger.hh"
+
+#include <cstring>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+FFMPEGAV1Decoder::FFMPEGAV1Decoder(const webrtc::SdpVideoFormat &format,
+                                   Config conf)
+    : FFMPEGDecoder(format, conf)
+{
+}
+
+bool FFMPEGAV1Decoder::IsSupported()
+{
+    return avcodec_find_decoder_by_name(kDeviceDav1d) ||
+           avcodec_find_decoder_by_name(kDeviceAOM);
+}
+
+const AVCodec *FFMPEGAV1Decoder::find_codec()
+{
+    auto codec = avcodec_find_decoder_by_name(kDeviceDav1d);
+    if (!codec) {
+        codec = avcodec_find_decoder_by_name(kDeviceAOM);
+    }
+    return codec;
+}
+
+void FFMPEGAV1Decoder::configure()
+{
+    if (std::strcmp(avctx_->codec->name, kDeviceDav1d) == 0) {
+        // dav1d queues up to one frame per thread by default, return every
+        // picture as soon as it's decoded, the threads work on the tiles and
+        // postfilters of the current frame instead
+        av_opt_set_int(avctx_->priv_data, "max_frame_delay", 1, 0);
+    }
+    logger::debug("AV1 decoder backend: {}, threads: {}", avctx_->codec->name,
+                  avctx_->thread_count);
+}
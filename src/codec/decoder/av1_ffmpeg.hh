@@ -0,0 +1,29 @@
+#pragma once
+#include "h264_ffmpeg.hh"
+
+// AV1 low latency decoder, backed by dav1d (or libaom) through libavcodec
+class FFMPEGAV1Decoder : public FFMPEGDecoder
+{
+  public:
+    static constexpr const char *kDeviceDav1d = "libdav1d";
+    static constexpr const char *kDeviceAOM = "libaom-av1";
+
+  public:
+    FFMPEGAV1Decoder(const webrtc::SdpVideoFormat &format, Config conf = {});
+    ~FFMPEGAV1Decoder() override = default;
+
+    static bool IsSupported();
+
+  protected:
+    const AVCodec *find_codec() override;
+    void configure() override;
+    // the depacketizer outputs whole temporal units of low overhead OBUs
+    bool is_framed(const uint8_t *data, size_t size) const override
+    {
+        return size > 0;
+    }
+    const char *implementation_name() const override
+    {
+        return "av1_ffmpeg_decoder";
+    }
+};
@@ -1,16 +1,53 @@
 #include "factory.hh"
+#include "av1_ffmpeg.hh"
 #include "codec/h264.hh"
 #include "h264_ffmpeg.hh"
+#include "logger.hh"
+
+#include <algorithm>
+
+#include "absl/strings/match.h"
+#include "media/base/media_constants.h"
 
 std::vector<webrtc::SdpVideoFormat>
 CustomVideoDecoderFactory::GetSupportedFormats() const
 {
-    return supported_h264_codecs(true);
+    // libavcodec decodes High 4:4:4 Predictive as well, offered last so it's
+    // only used if the sender prefers it
+    auto formats = supported_h264_codecs(true);
+    auto i444 = supported_h264_444_codecs(true);
+    formats.insert(formats.end(), i444.begin(), i444.end());
+    if (FFMPEGAV1Decoder::IsSupported()) {
+        formats.emplace_back(cricket::kAv1CodecName);
+    }
+    return formats;
 }
 
 std::unique_ptr<webrtc::VideoDecoder>
 CustomVideoDecoderFactory::CreateVideoDecoder(
     const webrtc::SdpVideoFormat &format)
 {
-    return std::make_unique<FFMPEGDecoder>(format);
+    if (absl::EqualsIgnoreCase(format.name, cricket::kAv1CodecName)) {
+        return std::make_unique<FFMPEGAV1Decoder>(format, conf_);
+    }
+    return std::make_unique<FFMPEGDecoder>(format, conf_);
+}
+
+void CustomVideoDecoderFactory::Prewarm(const std::string &codec_name)
+{
+    auto formats = GetSupportedFormats();
+    auto format = std::find_if(formats.begin(), formats.end(),
+                               [&codec_name](const auto &f) {
+                                   return absl::EqualsIgnoreCase(f.name,
+                                                                 codec_name);
+                               });
+    if (format == formats.end()) {
+        return;
+    }
+
+    auto decoder = CreateVideoDecoder(*format);
+    if (decoder->Configure(webrtc::VideoDecoder::Settings())) {
+        logger::debug("prewarmed decoder {}", format->ToString());
+    }
+    decoder->Release();
 }
@@ -1,17 +1,28 @@
 #pragma once
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "api/video_codecs/video_decoder_factory.h"
+#include "codec/decoder/h264_ffmpeg.hh"
 
 class CustomVideoDecoderFactory : public webrtc::VideoDecoderFactory
 {
   public:
+    explicit CustomVideoDecoderFactory(FFMPEGDecoder::Config conf = {})
+        : conf_(conf)
+    {
+    }
     ~CustomVideoDecoderFactory() override = default;
     std::unique_ptr<webrtc::VideoDecoder>
     CreateVideoDecoder(const webrtc::SdpVideoFormat &format) override;
 
     std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
 
+    // open and release a decoder of `codec_name`, so the first session finds
+    // a warm context in `CodecPool`
+    void Prewarm(const std::string &codec_name);
+
   private:
+    FFMPEGDecoder::Config conf_;
 };
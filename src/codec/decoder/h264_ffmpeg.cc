@@ -1,5 +1,10 @@
 #include "h264_ffmpeg.hh"
+#include "codec/pool.hh"
 #include "logger.hh"
+#include "stats/decoder_stats.hh"
+
+#include <algorithm>
+#include <cstring>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -7,7 +12,11 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+#include "api/video/i444_buffer.h"
 #include "api/video_codecs/video_codec.h"
+#include "common_video/h264/h264_common.h"
+#include "common_video/h264/sps_parser.h"
+#include "common_video/include/video_frame_buffer.h"
 #include "media/base/codec.h"
 #include "modules/video_coding/include/video_codec_interface.h"
 #include "modules/video_coding/include/video_error_codes.h"
@@ -18,9 +27,12 @@ extern "C" {
 #define av_err2str(r) (r)
 #endif
 
-FFMPEGDecoder::FFMPEGDecoder(const webrtc::SdpVideoFormat &format)
+FFMPEGDecoder::FFMPEGDecoder(const webrtc::SdpVideoFormat &format,
+                             Config conf)
+    : conf_(conf)
 {
-    logger::debug("create decoder, format: {}", format.ToString());
+    logger::debug("create decoder, format: {}, threads: {}", format.ToString(),
+                  conf_.threads);
     // TODO: parse profile/level
 }
 
@@ -28,22 +40,88 @@ FFMPEGDecoder::~FFMPEGDecoder() { Release(); }
 
 bool FFMPEGDecoder::Configure(const webrtc::VideoDecoder::Settings &settings)
 {
-    codec_ = avcodec_find_decoder(AV_CODEC_ID_H264);
+    codec_ = find_codec();
+    if (!codec_) {
+        logger::error("failed to find decoder of {}", implementation_name());
+        return false;
+    }
     parser_ = av_parser_init(codec_->id);
-    avctx_ = avcodec_alloc_context3(codec_);
-    int ret = avcodec_open2(avctx_, codec_, nullptr);
-    if (ret < 0) {
-        logger::error("failed to open codec: {}", "h264");
+    // the first key frame's SPS decides, see `may_reorder`
+    if (!open_context(conf_.low_delay)) {
         return false;
     }
+    use_parser_ = false;
+    waiting_for_key_ = false;
 
     packet_ = av_packet_alloc();
     frame_ = av_frame_alloc();
 
-    logger::debug("init decoder ok, start decoding");
+    logger::debug("init decoder ok with {} threads, start decoding",
+                  avctx_->thread_count);
+    return true;
+}
+
+bool FFMPEGDecoder::open_context(bool low_delay)
+{
+    avctx_ = avcodec_alloc_context3(codec_);
+    // decode slices of the same frame in parallel, frame threading would
+    // delay the output by `thread_count` frames
+    avctx_->thread_type = FF_THREAD_SLICE;
+    avctx_->thread_count = std::max(conf_.threads, 0);
+    if (low_delay) {
+        avctx_->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+    if (conf_.fast) {
+        avctx_->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    configure();
+
+    auto key = CodecPool::key(
+        avctx_, fmt::format("{}:{}", avctx_->flags, avctx_->flags2));
+    if (auto *warm = CodecPool::instance().acquire(key)) {
+        avcodec_free_context(&avctx_);
+        avctx_ = warm;
+    } else {
+        int ret = avcodec_open2(avctx_, codec_, nullptr);
+        if (ret < 0) {
+            logger::error("failed to open codec: {}", codec_->name);
+            avcodec_free_context(&avctx_);
+            return false;
+        }
+    }
+    pool_key_ = key;
+    low_delay_ = low_delay;
+    // resolved by avcodec_open2 if auto
+    DecoderStats::instance().set_threads(avctx_->thread_count);
     return true;
 }
 
+absl::optional<bool> FFMPEGDecoder::may_reorder(const uint8_t *data,
+                                                size_t size)
+{
+    for (const auto &index : webrtc::H264::FindNaluIndices(data, size)) {
+        const uint8_t *nalu = data + index.payload_start_offset;
+        if (index.payload_size <= webrtc::H264::kNaluTypeSize ||
+            webrtc::H264::ParseNaluType(nalu[0]) != webrtc::H264::kSps) {
+            continue;
+        }
+        // profile_idc, Baseline streams have no B slices
+        if (nalu[1] == 66) {
+            return false;
+        }
+        auto sps = webrtc::SpsParser::ParseSps(
+            nalu + webrtc::H264::kNaluTypeSize,
+            index.payload_size - webrtc::H264::kNaluTypeSize);
+        if (!sps) {
+            return absl::nullopt;
+        }
+        // type 2 derives the order count from frame_num, the output order is
+        // the decoding order
+        return sps->pic_order_cnt_type != 2;
+    }
+    return absl::nullopt;
+}
+
 int32_t FFMPEGDecoder::RegisterDecodeCompleteCallback(
     webrtc::DecodedImageCallback *callback)
 {
@@ -53,13 +131,12 @@ int32_t FFMPEGDecoder::RegisterDecodeCompleteCallback(
 
 int32_t FFMPEGDecoder::Release()
 {
-    if (avctx_) {
-        avcodec_send_packet(avctx_, nullptr);
-        av_frame_free(&frame_);
-        av_packet_free(&packet_);
-        av_parser_close(parser_);
-        avcodec_free_context(&avctx_);
-    }
+    // `avctx_` is gone if opening it failed
+    av_frame_free(&frame_);
+    av_packet_free(&packet_);
+    av_parser_close(parser_);
+    parser_ = nullptr;
+    CodecPool::instance().release(pool_key_, avctx_);
 
     return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -70,18 +147,74 @@ int32_t FFMPEGDecoder::Decode(const webrtc::EncodedImage &image,
     int ret;
     auto *data = const_cast<uint8_t *>(image.data());
     auto size = image.size();
+    decode_start_us_ = rtc::TimeMicros();
+    if (!avctx_) {
+        return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+
+    bool key = image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+    // nothing but a key frame is decodable after a loss
+    if ((missing_frames || waiting_for_key_) && !key) {
+        DecoderStats::instance().conceal();
+        return wait_for_key_frame("frames missing");
+    }
+    if (waiting_for_key_) {
+        // drop the pictures of the broken reference chain
+        avcodec_flush_buffers(avctx_);
+        waiting_for_key_ = false;
+        logger::debug("recovered with key frame {}", image.Timestamp());
+    }
+    // low delay output shows the B pictures of a stream out of order until
+    // libavcodec grows the reorder buffer, so the sender's SPS decides
+    if (key && conf_.low_delay && codec_->id == AV_CODEC_ID_H264) {
+        auto reorder = may_reorder(data, size);
+        if (reorder && *reorder == low_delay_) {
+            logger::debug("stream {} reorder frames, low delay: {}",
+                          *reorder ? "may" : "doesn't", !*reorder);
+            auto *current = avctx_;
+            auto current_key = pool_key_;
+            if (open_context(!*reorder)) {
+                CodecPool::instance().release(current_key, current);
+            } else {
+                // still decodable, only with the other delay
+                avctx_ = current;
+            }
+        }
+    }
+
+    // the RTP depacketizer already assembled a whole access unit, send it as
+    // one packet instead of waiting for the parser to find the next one
+    if (!use_parser_ && is_framed(data, size)) {
+        // libavcodec reads past the end of the bitstream, so the data is
+        // copied into a padded packet
+        ret = av_new_packet(packet_, static_cast<int>(size));
+        if (ret < 0) {
+            return WEBRTC_VIDEO_CODEC_MEMORY;
+        }
+        memcpy(packet_->data, data, size);
+        packet_->pts = image.Timestamp();
+        ret = do_decode(image, render_time_ms);
+        av_packet_unref(packet_);
+        return ret;
+    }
+    if (!use_parser_ && size > 0) {
+        logger::warn("access unit without start code, fallback to parser");
+        use_parser_ = true;
+    }
 
     while (size) {
         ret = av_parser_parse2(parser_, avctx_, &packet_->data, &packet_->size,
-                               data, size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+                               data, size, image.Timestamp(), AV_NOPTS_VALUE,
+                               0);
         data += ret;
         size -= ret;
         if (packet_->size == 0) {
             continue;
         }
+        packet_->pts = parser_->pts;
 
         ret = do_decode(image, render_time_ms);
-        if (ret < 0) {
+        if (ret != WEBRTC_VIDEO_CODEC_OK) {
             return ret;
         }
     }
@@ -89,44 +222,140 @@ int32_t FFMPEGDecoder::Decode(const webrtc::EncodedImage &image,
     return WEBRTC_VIDEO_CODEC_OK;
 }
 
+int32_t FFMPEGDecoder::wait_for_key_frame(const char *reason)
+{
+    auto now_ms = rtc::TimeMillis();
+    if (!waiting_for_key_) {
+        logger::warn("{}, freeze until the next key frame", reason);
+        waiting_for_key_ = true;
+    } else if (now_ms - key_requested_ms_ < kKeyFrameRetryMs) {
+        // requested already for this loss
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+    key_requested_ms_ = now_ms;
+    DecoderStats::instance().request_key_frame();
+    return WEBRTC_VIDEO_CODEC_OK_REQUEST_KEYFRAME;
+}
+
+bool FFMPEGDecoder::has_start_code(const uint8_t *data, size_t size)
+{
+    // 00 00 01 or 00 00 00 01
+    return (size > 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+           (size > 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 &&
+            data[3] == 1);
+}
+
 int FFMPEGDecoder::do_decode(const webrtc::EncodedImage &image,
                              int64_t render_time_ms)
 {
     int ret = avcodec_send_packet(avctx_, packet_);
     if (ret < 0) {
         logger::warn("failed to send packet: {}", av_err2str(ret));
-        return WEBRTC_VIDEO_CODEC_ERROR;
+        return wait_for_key_frame("undecodable packet");
     }
 
+    int32_t result = WEBRTC_VIDEO_CODEC_OK;
     while (true) {
         ret = avcodec_receive_frame(avctx_, frame_);
         if (ret < 0) {
             break;
         }
+        // references were lost or broken, keep the last good frame on screen
+        // instead of the concealed one
+        if ((frame_->flags & AV_FRAME_FLAG_CORRUPT) ||
+            frame_->decode_error_flags || waiting_for_key_) {
+            DecoderStats::instance().conceal();
+            result = wait_for_key_frame("corrupt frame");
+            continue;
+        }
 
-        assert(frame_->format == AV_PIX_FMT_YUV420P);
-        buffer_ =
-            webrtc::I420Buffer::Copy(frame_->width, frame_->height,        //
-                                     frame_->data[0], frame_->linesize[0], //
-                                     frame_->data[1], frame_->linesize[1], //
-                                     frame_->data[2], frame_->linesize[2]);
+        bool i444 = frame_->format == AV_PIX_FMT_YUV444P ||
+                    frame_->format == AV_PIX_FMT_YUVJ444P;
+        if (!i444 && frame_->format != AV_PIX_FMT_YUV420P &&
+            frame_->format != AV_PIX_FMT_YUVJ420P) {
+            // e.g. 10 bit AV1
+            logger::error("unsupported decoded format: {}",
+                          av_get_pix_fmt_name(
+                              static_cast<AVPixelFormat>(frame_->format)));
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+        buffer_ = *held_frames_ < kMaxHeldFrames ? wrap_frame(i444)
+                                                 : copy_frame(i444);
 
         webrtc::VideoFrame frame(buffer_, webrtc::kVideoRotation_0,
                                  render_time_ms *
                                      rtc::kNumMicrosecsPerMillisec);
-        frame.set_timestamp(image.Timestamp());
+        // frames are reordered if the stream has B pictures
+        frame.set_timestamp(frame_->pts != AV_NOPTS_VALUE
+                                ? static_cast<uint32_t>(frame_->pts)
+                                : image.Timestamp());
         frame.set_ntp_time_ms(image.NtpTimeMs());
 
-        callback_->Decoded(frame);
+        DecoderStats::Frame stats;
+        stats.rtp_timestamp = frame.timestamp();
+        stats.decoded_time_us = rtc::TimeMicros();
+        stats.width = frame_->width;
+        stats.height = frame_->height;
+        stats.size = image.size();
+        stats.decode_us = stats.decoded_time_us - decode_start_us_;
+        DecoderStats::instance().add(stats);
+
+        callback_->Decoded(frame, static_cast<int32_t>(stats.decode_us / 1000),
+                           absl::nullopt);
     }
 
-    return WEBRTC_VIDEO_CODEC_OK;
+    return result;
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+FFMPEGDecoder::wrap_frame(bool i444)
+{
+    // the planes stay in the decoder's buffer pool until the sinks are done
+    // with them, `frame_` is reused by the next avcodec_receive_frame
+    AVFrame *ref = av_frame_clone(frame_);
+    if (!ref) {
+        return copy_frame(i444);
+    }
+    ++*held_frames_;
+    auto release = [ref, held = held_frames_]() mutable {
+        av_frame_free(&ref);
+        --*held;
+    };
+
+    // High 4:4:4 Predictive, full chroma
+    auto type = i444 ? webrtc::VideoFrameBuffer::Type::kI444
+                     : webrtc::VideoFrameBuffer::Type::kI420;
+    return webrtc::WrapYuvBuffer(type, ref->width, ref->height,  //
+                                 ref->data[0], ref->linesize[0], //
+                                 ref->data[1], ref->linesize[1], //
+                                 ref->data[2], ref->linesize[2], //
+                                 std::move(release));
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+FFMPEGDecoder::copy_frame(bool i444)
+{
+    if (i444) {
+        return webrtc::I444Buffer::Copy(frame_->width, frame_->height,        //
+                                        frame_->data[0], frame_->linesize[0], //
+                                        frame_->data[1], frame_->linesize[1], //
+                                        frame_->data[2], frame_->linesize[2]);
+    }
+    return webrtc::I420Buffer::Copy(frame_->width, frame_->height,        //
+                                    frame_->data[0], frame_->linesize[0], //
+                                    frame_->data[1], frame_->linesize[1], //
+                                    frame_->data[2], frame_->linesize[2]);
+}
+
+const AVCodec *FFMPEGDecoder::find_codec()
+{
+    return avcodec_find_decoder(AV_CODEC_ID_H264);
 }
 
 webrtc::VideoDecoder::DecoderInfo FFMPEGDecoder::GetDecoderInfo() const
 {
     DecoderInfo info;
-    info.implementation_name = "h264_ffmpeg_decoder";
+    info.implementation_name = implementation_name();
     info.is_hardware_accelerated = false;
     return info;
 }
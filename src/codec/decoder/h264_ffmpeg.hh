@@ -1,4 +1,9 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "absl/types/optional.h"
 #include "api/scoped_refptr.h"
 #include "api/video/encoded_image.h"
 #include "api/video/i420_buffer.h"
@@ -16,9 +21,27 @@ class FFMPEGDecoder : public webrtc::VideoDecoder
 {
   public:
     const char *kDeviceVAAPI = "h264_vaapi";
+    // decoded frames the sinks may hold before they get copies instead, the
+    // decoder's buffer pool grows by one frame for each of them
+    static constexpr int kMaxHeldFrames = 8;
+    // a key frame request is repeated only if no key frame came within this
+    // time, the request itself may be lost
+    static constexpr int64_t kKeyFrameRetryMs = 1000;
+
+    struct Config {
+        // decoding threads, 0 for one per core
+        int threads = 0;
+        // output every frame as soon as it's decoded instead of filling the
+        // reorder buffer first, used only while the sender's SPS rules out
+        // reordered pictures
+        bool low_delay = true;
+        // AV_CODEC_FLAG2_FAST, skip spec compliance work conforming streams
+        // don't need
+        bool fast = false;
+    };
 
   public:
-    FFMPEGDecoder(const webrtc::SdpVideoFormat &format);
+    FFMPEGDecoder(const webrtc::SdpVideoFormat &format, Config conf = {});
     ~FFMPEGDecoder() override;
     bool Configure(const webrtc::VideoDecoder::Settings &settings) override;
 
@@ -31,9 +54,43 @@ class FFMPEGDecoder : public webrtc::VideoDecoder
                    int64_t render_time_ms) override;
     DecoderInfo GetDecoderInfo() const override;
 
+  protected:
+    // codec specific parts, overridden by other codecs sharing the decoding
+    // loop, see `FFMPEGAV1Decoder`
+    virtual const AVCodec *find_codec();
+    // set codec specific options of `avctx_` before opening it
+    virtual void configure() {}
+    // `data` is a whole access unit that could be sent as one packet
+    virtual bool is_framed(const uint8_t *data, size_t size) const
+    {
+        return has_start_code(data, size);
+    }
+    virtual const char *implementation_name() const
+    {
+        return "h264_ffmpeg_decoder";
+    }
+
   private:
     int set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx);
+    // a warm or newly opened `avctx_`, see `CodecPool`
+    bool open_context(bool low_delay);
+    // whether the SPS of the access unit allows reordered output, nullopt if
+    // there is none
+    static absl::optional<bool> may_reorder(const uint8_t *data, size_t size);
     int do_decode(const webrtc::EncodedImage &image, int64_t render_time_ms);
+    // freeze until the next key frame, the result requests one once per loss
+    int32_t wait_for_key_frame(const char *reason);
+    // Annex B stream, as the H264 depacketizer produces
+    static bool has_start_code(const uint8_t *data, size_t size);
+    // `frame_` as a buffer referencing its planes, or a copy of them
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> wrap_frame(bool i444);
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> copy_frame(bool i444);
+
+  protected:
+    // properties
+    Config conf_;
+    // internal resources
+    AVCodecContext *avctx_ = nullptr;
 
   private:
     // external resources
@@ -41,9 +98,21 @@ class FFMPEGDecoder : public webrtc::VideoDecoder
     // internal resources
     webrtc::H264BitstreamParser h264_bit_stream_parser_;
     const AVCodec *codec_ = nullptr;
-    AVCodecContext *avctx_ = nullptr;
     AVCodecParserContext *parser_ = nullptr;
     AVFrame *frame_ = nullptr;
     AVPacket *packet_ = nullptr;
-    rtc::scoped_refptr<webrtc::I420Buffer> buffer_ = nullptr;
+    std::string pool_key_;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer_ = nullptr;
+    // states
+    // split the input with `parser_`, the stream isn't framed as expected
+    bool use_parser_ = false;
+    // `avctx_` was opened with AV_CODEC_FLAG_LOW_DELAY
+    bool low_delay_ = false;
+    int64_t decode_start_us_ = 0;
+    // a reference is missing, frames are dropped until the next key frame
+    bool waiting_for_key_ = false;
+    int64_t key_requested_ms_ = 0;
+    // wrapped frames still referenced, buffers may outlive the decoder
+    std::shared_ptr<std::atomic<int>> held_frames_ =
+        std::make_shared<std::atomic<int>>(0);
 };
@@ -0,0 +1,78 @@
+#include "dirty_rects.hh"
+
+#include <algorithm>
+#include <cstring>
+
+DirtyRects &DirtyRects::instance()
+{
+    static DirtyRects rects;
+    return rects;
+}
+
+void DirtyRects::set_sender(Sender sender)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    sender_ = std::move(sender);
+}
+
+void DirtyRects::publish(const Update &update)
+{
+    Sender sender;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sender = sender_;
+    }
+    // the sender blocks on the signaling thread, which may be waiting in
+    // `set_sender`, so it's called unlocked. It keeps its channel alive.
+    if (sender) {
+        sender(reinterpret_cast<const uint8_t *>(&update), sizeof(update));
+    }
+}
+
+void DirtyRects::receive(const uint8_t *data, size_t size)
+{
+    if (size != sizeof(Update)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memcpy(&updates_[count_++ % kCapacity], data, size);
+}
+
+std::optional<webrtc::VideoFrame::UpdateRect>
+DirtyRects::since(uint32_t from, uint32_t to) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    webrtc::VideoFrame::UpdateRect rect{0, 0, 0, 0};
+    // messages may be lost or reordered, walk back along the previous links
+    for (int i = 0; i < kMaxChain && to != from; i++) {
+        auto *update = find(to);
+        if (!update) {
+            return std::nullopt;
+        }
+        rect.Union({update->x, update->y, update->width, update->height});
+        to = update->previous;
+    }
+    if (to != from) {
+        return std::nullopt;
+    }
+    return rect;
+}
+
+void DirtyRects::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    count_ = 0;
+}
+
+const DirtyRects::Update *DirtyRects::find(uint32_t timestamp) const
+{
+    auto n = std::min(count_, kCapacity);
+    // newest first, RTP timestamps wrap
+    for (size_t i = 1; i <= n; i++) {
+        const auto &update = updates_[(count_ - i) % kCapacity];
+        if (update.timestamp == timestamp) {
+            return &update;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+#include "api/video/video_frame.h"
+
+// The changed area of each encoded frame, sent by the sharer over an
+// unreliable data channel and looked up by the viewer's renderer, so it
+// uploads only what changed. Frames are keyed by RTP timestamp.
+class DirtyRects
+{
+  public:
+    // the wire format, in host byte order like the input events
+    struct Update {
+        uint32_t timestamp = 0;
+        // the frame sent before, `rect` is relative to it
+        uint32_t previous = 0;
+        uint16_t x = 0;
+        uint16_t y = 0;
+        uint16_t width = 0;
+        uint16_t height = 0;
+    };
+    static_assert(sizeof(Update) == 16);
+
+    // updates kept for the lookup, a few frames of decoding delay
+    static constexpr size_t kCapacity = 64;
+    // frames further apart are uploaded in full
+    static constexpr int kMaxChain = 8;
+
+    // sends one message, false if it couldn't be queued
+    using Sender = std::function<bool(const uint8_t *data, size_t size)>;
+
+  public:
+    static DirtyRects &instance();
+
+    // sharer side, updates are dropped without a sender
+    void set_sender(Sender sender);
+    void publish(const Update &update);
+
+    // viewer side
+    void receive(const uint8_t *data, size_t size);
+    // union of the changes from frame `from` to frame `to`, nothing if one of
+    // the frames in between is unknown
+    std::optional<webrtc::VideoFrame::UpdateRect> since(uint32_t from,
+                                                        uint32_t to) const;
+    void clear();
+
+  private:
+    const Update *find(uint32_t timestamp) const;
+
+  private:
+    mutable std::mutex mutex_;
+    Sender sender_;
+    std::array<Update, kCapacity> updates_ = {};
+    size_t count_ = 0;
+};
@@ -0,0 +1,57 @@
+#include "dirty_rects.hh"
+
+#include <cassert>
+#include <cstdio>
+
+static void receive(uint32_t timestamp, uint32_t previous, uint16_t x,
+                    uint16_t y, uint16_t width, uint16_t height)
+{
+    DirtyRects::Update update{timestamp, previous, x, y, width, height};
+    DirtyRects::instance().receive(reinterpret_cast<const uint8_t *>(&update),
+                                   sizeof(update));
+}
+
+static bool equals(const std::optional<webrtc::VideoFrame::UpdateRect> &rect,
+                   int x, int y, int width, int height)
+{
+    return rect && rect->offset_x == x && rect->offset_y == y &&
+           rect->width == width && rect->height == height;
+}
+
+int main(int argc, char *argv[])
+{
+    auto &rects = DirtyRects::instance();
+    receive(2, 1, 0, 0, 10, 10);
+    receive(3, 2, 20, 20, 10, 10);
+
+    // union along the chain, nothing changed within one frame
+    assert(equals(rects.since(1, 3), 0, 0, 30, 30));
+    assert(equals(rects.since(2, 3), 20, 20, 10, 10));
+    assert(equals(rects.since(3, 3), 0, 0, 0, 0));
+    // frame 1 doesn't lead to frame 0, frame 4 is lost
+    assert(!rects.since(0, 3));
+    assert(!rects.since(3, 4));
+
+    // received out of order
+    receive(5, 4, 0, 0, 1, 1);
+    receive(4, 3, 0, 0, 1, 1);
+    assert(equals(rects.since(1, 5), 0, 0, 30, 30));
+
+    // longer chains are uploaded in full
+    for (uint32_t t = 6; t < 6 + DirtyRects::kMaxChain; t++) {
+        receive(t, t - 1, 0, 0, 1, 1);
+    }
+    assert(rects.since(5, 5 + DirtyRects::kMaxChain));
+    assert(!rects.since(4, 5 + DirtyRects::kMaxChain));
+
+    // messages of another size are ignored
+    uint8_t garbage[4] = {};
+    rects.receive(garbage, sizeof(garbage));
+    assert(equals(rects.since(2, 3), 20, 20, 10, 10));
+
+    rects.clear();
+    assert(!rects.since(2, 3));
+
+    std::printf("dirty rects tests passed\n");
+    return 0;
+}
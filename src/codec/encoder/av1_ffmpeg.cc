@@ -0,0 +1,90 @@
+#include "av1_ffmpeg.hh"
+#include "logger.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/intreadwrite.h>
+#include <libavutil/opt.h>
+}
+
+#include "modules/video_coding/include/video_error_codes.h"
+
+// there are no periodic keyframes in real-time mode, loss recovery is driven
+// by keyframe requests
+static constexpr int kKeyFrameInterval = 3000;
+
+FFMPEGAV1Encoder::FFMPEGAV1Encoder(const webrtc::SdpVideoFormat &format,
+                                   Config conf)
+    : FFMPEGEncoder(format, std::move(conf))
+{
+    // neither of the AV1 backends uses hardware surfaces
+    hwac_ = false;
+}
+
+bool FFMPEGAV1Encoder::IsSupported()
+{
+    return avcodec_find_encoder_by_name(kDeviceAOM) ||
+           avcodec_find_encoder_by_name(kDeviceSVT);
+}
+
+const AVCodec *FFMPEGAV1Encoder::find_codec()
+{
+    auto codec = avcodec_find_encoder_by_name(kDeviceAOM);
+    if (!codec) {
+        codec = avcodec_find_encoder_by_name(kDeviceSVT);
+    }
+    return codec;
+}
+
+int FFMPEGAV1Encoder::configure(const webrtc::VideoCodec *codec_settings)
+{
+    avctx_->gop_size = kKeyFrameInterval;
+    auto *priv = avctx_->priv_data;
+    // tiles are the AV1 counterpart of H264 slices
+    int tile_rows =
+        std::bit_width(static_cast<unsigned>(std::max(conf_.slices, 1))) - 1;
+
+    if (std::strcmp(avctx_->codec->name, kDeviceAOM) == 0) {
+        av_opt_set(priv, "usage", "realtime", 0);
+        av_opt_set_int(priv, "cpu-used", 8, 0);
+        av_opt_set_int(priv, "lag-in-frames", 0, 0);
+        av_opt_set_int(priv, "row-mt", 1, 0);
+        av_opt_set_int(priv, "tile-rows", tile_rows, 0);
+        // screen content tools
+        av_opt_set_int(priv, "enable-palette", 1, 0);
+        av_opt_set_int(priv, "enable-intrabc", 1, 0);
+        av_opt_set(priv, "aom-params", "tune-content=screen", 0);
+    } else {
+        // low delay prediction structure, forced screen content mode
+        av_opt_set_int(priv, "preset", 12, 0);
+        av_opt_set(priv, "svtav1-params", "scm=1:pred-struct=1", 0);
+        av_opt_set_int(priv, "tile_rows", tile_rows, 0);
+    }
+
+    logger::debug("AV1 encoder backend: {}", avctx_->codec->name);
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void FFMPEGAV1Encoder::fill_codec_specific(webrtc::CodecSpecificInfo &info,
+                                           const webrtc::EncodedImage &image,
+                                           int64_t pts)
+{
+    info.codecType = webrtc::kVideoCodecAV1;
+    info.end_of_picture = true;
+}
+
+int FFMPEGAV1Encoder::parse_qp(const webrtc::EncodedImage &image,
+                               const AVPacket *pkt)
+{
+    // quality is exported as lambda, first field of the stats side data
+    size_t size = 0;
+    auto *stats =
+        av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS, &size);
+    if (!stats || size < 4) {
+        return -1;
+    }
+    return static_cast<int>(AV_RL32(stats)) / FF_QP2LAMBDA;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "h264_vaapi.hh"
+
+// AV1 real-time encoder with screen content tools, backed by libaom or
+// SVT-AV1 through libavcodec
+class FFMPEGAV1Encoder : public FFMPEGEncoder
+{
+  public:
+    static constexpr const char *kDeviceAOM = "libaom-av1";
+    static constexpr const char *kDeviceSVT = "libsvtav1";
+
+  public:
+    FFMPEGAV1Encoder(const webrtc::SdpVideoFormat &format, Config conf);
+    ~FFMPEGAV1Encoder() override = default;
+
+    static bool IsSupported();
+
+  protected:
+    webrtc::VideoCodecType codec_type() const override
+    {
+        return webrtc::kVideoCodecAV1;
+    }
+    const char *implementation_name() const override
+    {
+        return "av1_ffmpeg_encoder";
+    }
+    const AVCodec *find_codec() override;
+    int configure(const webrtc::VideoCodec *codec_settings) override;
+    void fill_codec_specific(webrtc::CodecSpecificInfo &info,
+                             const webrtc::EncodedImage &image,
+                             int64_t pts) override;
+    int parse_qp(const webrtc::EncodedImage &image,
+                 const AVPacket *pkt) override;
+};
@@ -0,0 +1,607 @@
+#include "capabilities.hh"
+#include "logger.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <mutex>
+
+#include <nlohmann/json.hpp>
+
+#include "common_video/h264/h264_common.h"
+#include "media/base/media_constants.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/opt.h>
+#ifdef __linux__
+#include <libavutil/hwcontext_vaapi.h>
+#endif
+}
+
+namespace fs = std::filesystem;
+using json = nlohmann::ordered_json;
+
+// candidates in order of preference
+static const char *kBackends[] = {"h264_vaapi", "libx264", "libaom-av1",
+                                  "libsvtav1"};
+// the capture resolution is benchmarked first, then the smaller ones of these
+static const std::pair<int, int> kResolutions[] = {
+    {7680, 4320}, {5120, 2880}, {3840, 2160},
+    {2560, 1600}, {1920, 1080}, {1280, 720},
+};
+static const int kH264Profiles[] = {
+    FF_PROFILE_H264_CONSTRAINED_BASELINE, FF_PROFILE_H264_BASELINE,
+    FF_PROFILE_H264_MAIN, FF_PROFILE_H264_HIGH,
+    FF_PROFILE_H264_HIGH_444_PREDICTIVE};
+// frame rate of the encoders, lower tiers are sustained if one reaches it
+static constexpr double kRealTimeFps = 60;
+static constexpr int kBenchmarkFrames = 60;
+static constexpr auto kBenchmarkTimeout = std::chrono::seconds(2);
+
+int ff_h264_profile(webrtc::H264Profile profile)
+{
+    switch (profile) {
+    case webrtc::H264Profile::kProfileConstrainedBaseline:
+        return FF_PROFILE_H264_CONSTRAINED_BASELINE;
+    case webrtc::H264Profile::kProfileBaseline:
+        return FF_PROFILE_H264_BASELINE;
+    case webrtc::H264Profile::kProfileMain:
+        return FF_PROFILE_H264_MAIN;
+    case webrtc::H264Profile::kProfileConstrainedHigh:
+    case webrtc::H264Profile::kProfileHigh:
+        return FF_PROFILE_H264_HIGH;
+    case webrtc::H264Profile::kProfilePredictiveHigh444:
+        return FF_PROFILE_H264_HIGH_444_PREDICTIVE;
+    }
+    return FF_PROFILE_H264_HIGH;
+}
+
+const char *x264_profile(int profile)
+{
+    switch (profile) {
+    case FF_PROFILE_H264_CONSTRAINED_BASELINE:
+    case FF_PROFILE_H264_BASELINE:
+        return "baseline";
+    case FF_PROFILE_H264_MAIN:
+        return "main";
+    case FF_PROFILE_H264_HIGH:
+        return "high";
+    case FF_PROFILE_H264_HIGH_444_PREDICTIVE:
+        return "high444";
+    }
+    return nullptr;
+}
+
+static bool is_h264(const std::string &name)
+{
+    return name.starts_with("h264") || name == "libx264";
+}
+
+static fs::path cache_path()
+{
+    fs::path dir;
+#ifdef _WIN32
+    if (auto *local = std::getenv("LOCALAPPDATA")) {
+        dir = local;
+    }
+#else
+    if (auto *xdg = std::getenv("XDG_CACHE_HOME")) {
+        dir = xdg;
+    } else if (auto *home = std::getenv("HOME")) {
+        dir = fs::path(home) / ".cache";
+    }
+#endif
+    if (dir.empty()) {
+        dir = fs::temp_directory_path();
+    }
+    return dir / "dezk" / "encoder_caps.json";
+}
+
+// vendor string of the VAAPI driver, empty if there is no VAAPI device
+static std::string vaapi_driver(AVBufferRef **device)
+{
+#ifdef __linux__
+    if (av_hwdevice_ctx_create(device, AV_HWDEVICE_TYPE_VAAPI, nullptr,
+                               nullptr, 0) < 0) {
+        return {};
+    }
+    auto *hwctx = reinterpret_cast<AVHWDeviceContext *>((*device)->data);
+    auto *vactx = static_cast<AVVAAPIDeviceContext *>(hwctx->hwctx);
+    const char *vendor = vaQueryVendorString(vactx->display);
+    return vendor ? vendor : "vaapi";
+#else
+    return {};
+#endif
+}
+
+static AVCodecContext *open_context(const AVCodec *codec, AVBufferRef *device,
+                                    int width, int height, int profile)
+{
+    auto *ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        return nullptr;
+    }
+    ctx->width = width;
+    ctx->height = height;
+    ctx->framerate = AVRational{60, 1};
+    ctx->time_base = av_inv_q(ctx->framerate);
+    ctx->gop_size = 600;
+    ctx->max_b_frames = 0;
+    ctx->profile = profile;
+    ctx->pix_fmt = profile == FF_PROFILE_H264_HIGH_444_PREDICTIVE
+                       ? AV_PIX_FMT_YUV444P
+                       : AV_PIX_FMT_YUV420P;
+
+    // same real-time settings as the encoders
+    if (std::strcmp(codec->name, "libx264") == 0) {
+        av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+        if (auto *name = x264_profile(profile)) {
+            av_opt_set(ctx->priv_data, "profile", name, 0);
+        }
+    } else if (std::strcmp(codec->name, "libaom-av1") == 0) {
+        av_opt_set(ctx->priv_data, "usage", "realtime", 0);
+        av_opt_set_int(ctx->priv_data, "cpu-used", 8, 0);
+        av_opt_set_int(ctx->priv_data, "lag-in-frames", 0, 0);
+    } else if (std::strcmp(codec->name, "libsvtav1") == 0) {
+        av_opt_set_int(ctx->priv_data, "preset", 12, 0);
+    }
+
+    if (device) {
+        ctx->pix_fmt = AV_PIX_FMT_VAAPI;
+        auto *frames_ref = av_hwframe_ctx_alloc(device);
+        if (!frames_ref) {
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        auto *frames = reinterpret_cast<AVHWFramesContext *>(frames_ref->data);
+        frames->format = AV_PIX_FMT_VAAPI;
+        frames->sw_format = AV_PIX_FMT_NV12;
+        frames->width = width;
+        frames->height = height;
+        frames->initial_pool_size = 4;
+        if (av_hwframe_ctx_init(frames_ref) < 0) {
+            av_buffer_unref(&frames_ref);
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        ctx->hw_frames_ctx = frames_ref;
+    }
+
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        avcodec_free_context(&ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+// uploads `swframe` first if `ctx` encodes hardware surfaces
+static int send_frame(AVCodecContext *ctx, AVFrame *swframe, AVFrame *hwframe)
+{
+    if (!ctx->hw_frames_ctx) {
+        return avcodec_send_frame(ctx, swframe);
+    }
+    av_frame_unref(hwframe);
+    int ret = av_hwframe_get_buffer(ctx->hw_frames_ctx, hwframe, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = av_hwframe_transfer_data(hwframe, swframe, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    hwframe->pts = swframe->pts;
+    return avcodec_send_frame(ctx, hwframe);
+}
+
+// profile_idc and constraint flags of the first SPS in `data`
+static absl::optional<webrtc::H264Profile> sps_profile(const uint8_t *data,
+                                                       size_t size)
+{
+    for (const auto &index : webrtc::H264::FindNaluIndices(data, size)) {
+        const uint8_t *nalu = data + index.payload_start_offset;
+        if (index.payload_size < 4 ||
+            webrtc::H264::ParseNaluType(nalu[0]) != webrtc::H264::kSps) {
+            continue;
+        }
+        // the same three bytes as profile-level-id
+        auto pl = webrtc::ParseH264ProfileLevelId(
+            fmt::format("{:02x}{:02x}{:02x}", nalu[1], nalu[2], nalu[3])
+                .c_str());
+        if (!pl) {
+            return absl::nullopt;
+        }
+        return pl->profile;
+    }
+    return absl::nullopt;
+}
+
+// the profile of the SPS written for one flat frame
+static absl::optional<webrtc::H264Profile> emitted_profile(AVCodecContext *ctx)
+{
+    AVFrame *swframe = av_frame_alloc();
+    AVFrame *hwframe = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    swframe->format = ctx->hw_frames_ctx ? AV_PIX_FMT_YUV420P : ctx->pix_fmt;
+    swframe->width = ctx->width;
+    swframe->height = ctx->height;
+    swframe->pts = 0;
+
+    absl::optional<webrtc::H264Profile> profile;
+    if (av_frame_get_buffer(swframe, 0) >= 0) {
+        bool i444 = swframe->format == AV_PIX_FMT_YUV444P;
+        for (int i = 0; i < 3; i++) {
+            int rows = i == 0 || i444 ? ctx->height : (ctx->height + 1) / 2;
+            memset(swframe->data[i], 128, swframe->linesize[i] * rows);
+        }
+        if (send_frame(ctx, swframe, hwframe) >= 0) {
+            avcodec_send_frame(ctx, nullptr);
+            while (!profile && avcodec_receive_packet(ctx, packet) == 0) {
+                profile = sps_profile(packet->data, packet->size);
+                av_packet_unref(packet);
+            }
+        }
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&hwframe);
+    av_frame_free(&swframe);
+    return profile;
+}
+
+// a Constrained Baseline stream is a valid Baseline one
+static bool conforms(webrtc::H264Profile emitted, int profile)
+{
+    return ff_h264_profile(emitted) == profile ||
+           (profile == FF_PROFILE_H264_BASELINE &&
+            emitted == webrtc::H264Profile::kProfileConstrainedBaseline);
+}
+
+// frames per second of a short encode of a moving pattern
+static double benchmark(const AVCodec *codec, AVBufferRef *device, int width,
+                        int height)
+{
+    auto *ctx = open_context(codec, device, width, height, FF_PROFILE_UNKNOWN);
+    if (!ctx) {
+        return 0;
+    }
+
+    AVFrame *swframe = av_frame_alloc();
+    AVFrame *hwframe = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    swframe->format = AV_PIX_FMT_YUV420P;
+    swframe->width = width;
+    swframe->height = height;
+    av_frame_get_buffer(swframe, 0);
+    memset(swframe->data[1], 128, swframe->linesize[1] * height / 2);
+    memset(swframe->data[2], 128, swframe->linesize[2] * height / 2);
+
+    int encoded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kBenchmarkFrames; i++) {
+        for (int y = 0; y < height; y++) {
+            memset(swframe->data[0] + y * swframe->linesize[0],
+                   (y + i * 4) & 0xff, width);
+        }
+        swframe->pts = i;
+        if (send_frame(ctx, swframe, hwframe) < 0) {
+            break;
+        }
+        while (avcodec_receive_packet(ctx, packet) == 0) {
+            encoded++;
+            av_packet_unref(packet);
+        }
+        if (std::chrono::steady_clock::now() - start > kBenchmarkTimeout) {
+            break;
+        }
+    }
+    avcodec_send_frame(ctx, nullptr);
+    while (avcodec_receive_packet(ctx, packet) == 0) {
+        encoded++;
+        av_packet_unref(packet);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    av_packet_free(&packet);
+    av_frame_free(&hwframe);
+    av_frame_free(&swframe);
+    avcodec_free_context(&ctx);
+    return elapsed.count() > 0 ? encoded / elapsed.count() : 0;
+}
+
+bool EncoderCapabilities::Backend::has_profile(int profile) const
+{
+    return std::find(profiles.begin(), profiles.end(), profile) !=
+           profiles.end();
+}
+
+webrtc::H264Level EncoderCapabilities::Backend::sustained_level() const
+{
+    // e.g. too slow for 4K60 but fast enough for 1080p60, a level of the
+    // largest tier alone would be too low
+    absl::optional<webrtc::H264Level> best;
+    for (const auto &tier : tiers) {
+        auto level = webrtc::H264SupportedLevel(
+            tier.width * tier.height,
+            static_cast<float>(std::max(tier.fps, 1.0)));
+        if (level && (!best || *level > *best)) {
+            best = level;
+        }
+    }
+    return best.value_or(webrtc::H264Level::kLevel3_1);
+}
+
+static std::shared_future<EncoderCapabilities> &probe_result()
+{
+    static std::shared_future<EncoderCapabilities> result;
+    return result;
+}
+
+void EncoderCapabilities::Prefetch(int width, int height)
+{
+    static std::once_flag once;
+    std::call_once(once, [width, height] {
+        probe_result() = std::async(std::launch::async, [width, height] {
+            AVBufferRef *device = nullptr;
+            auto driver = vaapi_driver(&device);
+            av_buffer_unref(&device);
+            driver += fmt::format("|{}|{}x{}", av_version_info(), width,
+                                  height);
+
+            auto path = cache_path();
+            EncoderCapabilities caps;
+            if (caps.load(path.string(), driver)) {
+                logger::info("loaded encoder capabilities from {}",
+                             path.string());
+                return caps;
+            }
+
+            logger::info("probing encoder capabilities, driver: {}", driver);
+            caps = probe(driver, width, height);
+            caps.save(path.string());
+            logger::info("encoder capabilities probed");
+            return caps;
+        });
+    });
+}
+
+const EncoderCapabilities &EncoderCapabilities::Get()
+{
+    static const EncoderCapabilities fallback = defaults();
+    auto &result = probe_result();
+    if (result.valid() && result.wait_for(std::chrono::seconds(0)) ==
+                              std::future_status::ready) {
+        return result.get();
+    }
+    return fallback;
+}
+
+void EncoderCapabilities::Wait()
+{
+    auto &result = probe_result();
+    if (result.valid()) {
+        result.wait();
+    }
+}
+
+EncoderCapabilities EncoderCapabilities::defaults()
+{
+    EncoderCapabilities caps;
+    if (!avcodec_find_encoder_by_name("libx264")) {
+        return caps;
+    }
+    // no tiers, so the lowest advertised level, see `sustained_level`
+    caps.backends.push_back({
+        .name = "libx264",
+        .hardware = false,
+        .profiles = {FF_PROFILE_H264_CONSTRAINED_BASELINE,
+                     FF_PROFILE_H264_BASELINE, FF_PROFILE_H264_MAIN,
+                     FF_PROFILE_H264_HIGH},
+        .max_width = 3840,
+        .max_height = 2160,
+    });
+    return caps;
+}
+
+EncoderCapabilities EncoderCapabilities::probe(const std::string &driver,
+                                               int width, int height)
+{
+    EncoderCapabilities caps;
+    caps.driver = driver;
+
+    for (const char *name : kBackends) {
+        const AVCodec *codec = avcodec_find_encoder_by_name(name);
+        if (!codec) {
+            continue;
+        }
+
+        Backend backend;
+        backend.name = name;
+        backend.hardware = std::strstr(name, "vaapi") != nullptr;
+        AVBufferRef *device = nullptr;
+        if (backend.hardware && av_hwdevice_ctx_create(
+                                    &device, AV_HWDEVICE_TYPE_VAAPI, nullptr,
+                                    nullptr, 0) < 0) {
+            continue;
+        }
+
+        for (auto [w, h] : kResolutions) {
+            auto *ctx = open_context(codec, device, w, h, FF_PROFILE_UNKNOWN);
+            if (ctx) {
+                avcodec_free_context(&ctx);
+                backend.max_width = w;
+                backend.max_height = h;
+                break;
+            }
+        }
+        if (backend.max_width == 0) {
+            av_buffer_unref(&device);
+            continue;
+        }
+
+        if (is_h264(backend.name)) {
+            for (int profile : kH264Profiles) {
+                // no 4:4:4 surfaces for hardware encoders
+                if (backend.hardware &&
+                    profile == FF_PROFILE_H264_HIGH_444_PREDICTIVE) {
+                    continue;
+                }
+                // opening isn't enough, libx264 ignores the profile of the
+                // context and VAAPI drivers may fall back to another one
+                auto *ctx = open_context(codec, device, 1280, 720, profile);
+                if (!ctx) {
+                    continue;
+                }
+                auto emitted = emitted_profile(ctx);
+                avcodec_free_context(&ctx);
+                if (emitted && conforms(*emitted, profile)) {
+                    backend.profiles.push_back(profile);
+                }
+            }
+        }
+
+        // resolutions above the captured one are never encoded
+        std::vector<std::pair<int, int>> sizes = {{width, height}};
+        for (auto [w, h] : kResolutions) {
+            if (w * h < width * height) {
+                sizes.emplace_back(w, h);
+            }
+        }
+        for (auto [w, h] : sizes) {
+            if (w > backend.max_width || h > backend.max_height) {
+                continue;
+            }
+            Tier tier{w, h, benchmark(codec, device, w, h)};
+            logger::info("encoder backend {}: {}x{}@{:.1f}", backend.name, w,
+                         h, tier.fps);
+            backend.tiers.push_back(tier);
+            if (tier.fps >= kRealTimeFps) {
+                break;
+            }
+        }
+        av_buffer_unref(&device);
+
+        logger::info("encoder backend {}: max {}x{}, profiles: {}",
+                     backend.name, backend.max_width, backend.max_height,
+                     backend.profiles);
+        caps.backends.push_back(std::move(backend));
+    }
+
+    return caps;
+}
+
+bool EncoderCapabilities::load(const std::string &path,
+                               const std::string &drv)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+
+    auto o = json::parse(in, nullptr, false);
+    if (o.is_discarded()) {
+        return false;
+    }
+
+    // a cache of an older version or edited by hand is probed again
+    std::vector<Backend> loaded;
+    try {
+        if (o.at("driver").get<std::string>() != drv) {
+            return false;
+        }
+        for (const auto &b : o.at("backends")) {
+            Backend backend;
+            backend.name = b.at("name").get<std::string>();
+            backend.hardware = b.at("hardware").get<bool>();
+            backend.profiles = b.at("profiles").get<std::vector<int>>();
+            backend.max_width = b.at("max_width").get<int>();
+            backend.max_height = b.at("max_height").get<int>();
+            for (const auto &t : b.at("tiers")) {
+                backend.tiers.push_back({t.at("width").get<int>(),
+                                         t.at("height").get<int>(),
+                                         t.at("fps").get<double>()});
+            }
+            loaded.push_back(std::move(backend));
+        }
+    } catch (const json::exception &e) {
+        logger::warn("invalid encoder capabilities cache {}: {}", path,
+                     e.what());
+        return false;
+    }
+
+    driver = drv;
+    backends = std::move(loaded);
+    return true;
+}
+
+bool EncoderCapabilities::save(const std::string &path) const
+{
+    json o = {{"driver", driver}, {"backends", json::array()}};
+    for (const auto &b : backends) {
+        json tiers = json::array();
+        for (const auto &t : b.tiers) {
+            tiers.push_back(
+                {{"width", t.width}, {"height", t.height}, {"fps", t.fps}});
+        }
+        o["backends"].push_back({
+            {"name", b.name},
+            {"hardware", b.hardware},
+            {"profiles", b.profiles},
+            {"max_width", b.max_width},
+            {"max_height", b.max_height},
+            {"tiers", tiers},
+        });
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::ofstream out(path);
+    if (!out) {
+        logger::warn("failed to save encoder capabilities to {}", path);
+        return false;
+    }
+    out << o.dump(4);
+    return true;
+}
+
+const EncoderCapabilities::Backend *
+EncoderCapabilities::find(const std::string &name) const
+{
+    auto it = std::find_if(backends.begin(), backends.end(),
+                           [&name](const auto &b) { return b.name == name; });
+    return it == backends.end() ? nullptr : &*it;
+}
+
+std::vector<webrtc::SdpVideoFormat> EncoderCapabilities::filter_h264(
+    const std::vector<webrtc::SdpVideoFormat> &formats) const
+{
+    std::vector<webrtc::SdpVideoFormat> result;
+    for (const auto &format : formats) {
+        auto pl = webrtc::ParseSdpForH264ProfileLevelId(format.parameters);
+        if (!pl) {
+            continue;
+        }
+        auto profile = ff_h264_profile(pl->profile);
+        auto it = std::find_if(backends.begin(), backends.end(),
+                               [profile](const auto &b) {
+                                   return is_h264(b.name) &&
+                                          b.has_profile(profile);
+                               });
+        if (it == backends.end()) {
+            continue;
+        }
+
+        auto sdp = format;
+        sdp.parameters[cricket::kH264FmtpProfileLevelId] =
+            *webrtc::H264ProfileLevelIdToString(
+                webrtc::H264ProfileLevelId(pl->profile, it->sustained_level()));
+        result.push_back(std::move(sdp));
+    }
+    return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/h264_profile_level_id.h"
+#include "api/video_codecs/sdp_video_format.h"
+
+// FF_PROFILE_H264_* of a negotiated profile
+int ff_h264_profile(webrtc::H264Profile profile);
+// libx264's profile option of a FF_PROFILE_H264_*, libx264 doesn't take
+// `AVCodecContext::profile` as a constraint
+const char *x264_profile(int profile);
+
+// Encoder backends probed once per driver version, and cached on disk so
+// later startups skip the benchmark encode.
+struct EncoderCapabilities {
+    // a resolution the backend opens, and how fast it encodes there
+    struct Tier {
+        int width = 0;
+        int height = 0;
+        double fps = 0;
+    };
+    struct Backend {
+        // libavcodec encoder name, e.g. h264_vaapi, libx264
+        std::string name;
+        bool hardware = false;
+        // FF_PROFILE_* whose SPS the backend actually writes
+        std::vector<int> profiles;
+        int max_width = 0;
+        int max_height = 0;
+        // measured with a short benchmark encode, from the capture resolution
+        // down to the first one encoded in real time
+        std::vector<Tier> tiers;
+
+        bool has_profile(int profile) const;
+        // highest H264 level this backend sustains at any of its tiers
+        webrtc::H264Level sustained_level() const;
+    };
+
+    // cache key, driver vendor string, libavcodec version and capture
+    // resolution
+    std::string driver;
+    std::vector<Backend> backends;
+
+  public:
+    // start probing (or loading from cache) on a background thread, for
+    // screens of `width`x`height`. Only the first call probes.
+    static void Prefetch(int width, int height);
+    // the probed backends, or conservative defaults (libx264 at 4:2:0)
+    // until the probe is done, it never blocks the signaling thread
+    static const EncoderCapabilities &Get();
+    // blocks until the probe is done, for warming up off the signaling thread
+    static void Wait();
+
+    const Backend *find(const std::string &name) const;
+    // formats an H264 backend could sustain, keeps the order of `formats` and
+    // lowers levels which are out of reach of the preferred backend with the
+    // profile, e.g. libx264 for 4:4:4 if the hardware encoder is 4:2:0 only
+    std::vector<webrtc::SdpVideoFormat>
+    filter_h264(const std::vector<webrtc::SdpVideoFormat> &formats) const;
+
+  private:
+    static EncoderCapabilities defaults();
+    static EncoderCapabilities probe(const std::string &driver, int width,
+                                     int height);
+    bool load(const std::string &path, const std::string &driver);
+    bool save(const std::string &path) const;
+};
@@ -1,16 +1,81 @@
 #include "factory.hh"
+#include "av1_ffmpeg.hh"
+#include "capabilities.hh"
 #include "codec/h264.hh"
 #include "h264_vaapi.hh"
+#include "passthrough.hh"
+#include "logger.hh"
+
+#include <algorithm>
+
+#include "absl/strings/match.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/include/video_error_codes.h"
 
 std::vector<webrtc::SdpVideoFormat>
 CustomVideoEncoderFactory::GetSupportedFormats() const
 {
-    return supported_h264_codecs(true);
+    if (!conf_.passthrough_file.empty()) {
+        // no encoder backend is involved, the file decides the profile
+        return supported_h264_codecs(false);
+    }
+    // only what the probed backends could actually sustain, without
+    // temporal scalability modes: libavcodec has no per-frame reference
+    // control for libx264 or h264_vaapi
+    const auto &caps = EncoderCapabilities::Get();
+    auto formats = caps.filter_h264(supported_h264_codecs(false, conf_.i444));
+    if (caps.find(FFMPEGAV1Encoder::kDeviceAOM) ||
+        caps.find(FFMPEGAV1Encoder::kDeviceSVT)) {
+        formats.emplace_back(cricket::kAv1CodecName);
+    }
+    return formats;
 }
 
 std::unique_ptr<webrtc::VideoEncoder>
 CustomVideoEncoderFactory::CreateVideoEncoder(
     const webrtc::SdpVideoFormat &format)
 {
-    return std::make_unique<FFMPEGEncoder>(format);
+    if (absl::EqualsIgnoreCase(format.name, cricket::kAv1CodecName)) {
+        return std::make_unique<FFMPEGAV1Encoder>(format, conf_);
+    }
+    if (!conf_.passthrough_file.empty()) {
+        return std::make_unique<PassthroughEncoder>(format,
+                                                    conf_.passthrough_file);
+    }
+    return std::make_unique<FFMPEGEncoder>(format, conf_);
+}
+
+void CustomVideoEncoderFactory::Prewarm(const webrtc::SdpVideoFormat &wanted,
+                                        int width, int height)
+{
+    if (!conf_.passthrough_file.empty()) {
+        return;
+    }
+    // the level may differ, `filter_h264` lowers it to what's sustained
+    auto formats = GetSupportedFormats();
+    auto format = std::find_if(
+        formats.begin(), formats.end(),
+        [&wanted](const auto &f) { return wanted.IsSameCodec(f); });
+    if (format == formats.end()) {
+        return;
+    }
+
+    // what the session would configure, see `VideoCodecInitializer`
+    webrtc::VideoCodec codec;
+    codec.codecType = webrtc::PayloadStringToCodecType(format->name);
+    codec.width = width;
+    codec.height = height;
+    codec.maxFramerate = 60;
+    if (codec.codecType == webrtc::kVideoCodecH264) {
+        *codec.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+    }
+
+    auto encoder = CreateVideoEncoder(*format);
+    webrtc::VideoEncoder::Settings settings(
+        webrtc::VideoEncoder::Capabilities(false), 1, 0);
+    if (encoder->InitEncode(&codec, settings) == WEBRTC_VIDEO_CODEC_OK) {
+        logger::debug("prewarmed encoder {} {}x{}", format->ToString(), width,
+                      height);
+    }
+    encoder->Release();
 }
@@ -1,17 +1,28 @@
 #pragma once
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "api/video_codecs/video_encoder_factory.h"
+#include "codec/encoder/h264_vaapi.hh"
 
 class CustomVideoEncoderFactory : public webrtc::VideoEncoderFactory
 {
   public:
+    explicit CustomVideoEncoderFactory(FFMPEGEncoder::Config conf = {})
+        : conf_(conf)
+    {
+    }
     ~CustomVideoEncoderFactory() override = default;
     std::unique_ptr<webrtc::VideoEncoder>
     CreateVideoEncoder(const webrtc::SdpVideoFormat &format) override;
 
     std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
 
+    // open and release an encoder of `format`, e.g. the preferred one of the
+    // session, so the first session finds a warm context in `CodecPool`
+    void Prewarm(const webrtc::SdpVideoFormat &format, int width, int height);
+
   private:
+    FFMPEGEncoder::Config conf_;
 };
@@ -1,5 +1,15 @@
 #include "h264_vaapi.hh"
+#include "capabilities.hh"
+#include "regions.hh"
+#include "codec/dirty_rects.hh"
+#include "codec/h264.hh"
+#include "codec/pool.hh"
 #include "logger.hh"
+#include "stats/encoder_stats.hh"
+
+#include <algorithm>
+
+#include <libyuv/convert_from.h>
 
 extern "C" {
 #include <libavutil/hwcontext.h>
@@ -7,10 +17,14 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 }
 
+#include "api/video/i444_buffer.h"
 #include "api/video_codecs/video_codec.h"
 #include "api/video_codecs/video_encoder.h"
+#include "modules/include/module_common_types_public.h"
+#include "modules/video_coding/codecs/interface/common_constants.h"
 #include "modules/video_coding/include/video_codec_interface.h"
 #include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/time_utils.h"
 
 #ifdef _MSC_VER
 #undef av_err2str
@@ -21,9 +35,12 @@ using webrtc::VideoCodecMode;
 using webrtc::VideoCodecType;
 using webrtc::VideoFrameType;
 
-FFMPEGEncoder::FFMPEGEncoder(const webrtc::SdpVideoFormat &format)
+FFMPEGEncoder::FFMPEGEncoder(const webrtc::SdpVideoFormat &format,
+                             Config conf)
+    : conf_(conf)
 {
-    logger::debug("create encoder, format: {}", format.ToString());
+    logger::debug("create encoder, format: {}, slices: {}", format.ToString(),
+                  conf_.slices);
 
     {
         std::vector<std::string> devices;
@@ -35,22 +52,77 @@ FFMPEGEncoder::FFMPEGEncoder(const webrtc::SdpVideoFormat &format)
         } while (type != AV_HWDEVICE_TYPE_NONE);
         logger::debug("supported hardware encoding devices: {}", devices);
     }
+
+    hwac_ = EncoderCapabilities::Get().find(kDeviceVAAPI) != nullptr;
+    profile_level_id_ = webrtc::ParseSdpForH264ProfileLevelId(format.parameters);
+    i444_ = profile_level_id_ &&
+            profile_level_id_->profile ==
+                webrtc::H264Profile::kProfilePredictiveHigh444;
 }
 
 FFMPEGEncoder::~FFMPEGEncoder() { Release(); };
 
-void FFMPEGEncoder::SetRates(const RateControlParameters &parameters) {}
+void FFMPEGEncoder::SetRates(const RateControlParameters &parameters)
+{
+    if (parameters.framerate_fps > 0) {
+        frame_interval_us_ = static_cast<int64_t>(
+            rtc::kNumMicrosecsPerSec / parameters.framerate_fps);
+    }
+    auto bitrate = parameters.bitrate.get_sum_bps();
+    if (!avctx_ || !conf_.frame_vbv || bitrate == 0) {
+        return;
+    }
+    // libx264 reconfigures itself before the next frame, other backends keep
+    // the rates they were opened with
+    set_frame_vbv(bitrate, parameters.framerate_fps);
+}
+
+void FFMPEGEncoder::set_frame_vbv(int64_t bitrate, double fps)
+{
+    // a frame never takes longer than one frame interval to send at the
+    // target rate, a window switch raises QP instead of bursting
+    avctx_->bit_rate = bitrate;
+    avctx_->rc_max_rate = bitrate;
+    avctx_->rc_buffer_size = static_cast<int>(bitrate / std::max(fps, 1.0));
+    avctx_->rc_initial_buffer_occupancy = avctx_->rc_buffer_size;
+}
+
+void FFMPEGEncoder::OnLossNotification(const LossNotification &loss)
+{
+    // still decodable, e.g. only a non-reference picture was lost
+    if (loss.dependencies_of_last_received_decodable.value_or(true)) {
+        return;
+    }
+    // a key frame the receiver hasn't got yet is already on its way
+    if (last_key_rtp_ && webrtc::IsNewerTimestamp(
+                             *last_key_rtp_, loss.timestamp_of_last_received)) {
+        return;
+    }
+
+    // libavcodec has no per frame reference selection for any of the
+    // backends, so the next frame can't be predicted from the last decodable
+    // one and recovery falls back to a key frame
+    logger::debug("loss reported, last decodable: {}, recover with key frame",
+                  loss.timestamp_of_last_decodable);
+    recovery_pending_ = true;
+}
 
 int32_t FFMPEGEncoder::Release()
 {
-    // todo
+    // also undoes a partly failed InitEncode, every step is a no-op on null
+    av_frame_free(&swframe_);
+    av_frame_free(&hwframe_);
+    av_packet_free(&packet_);
+    input_ = nullptr;
     if (avctx_) {
-        avcodec_send_frame(avctx_, nullptr);
-        av_frame_free(&swframe_);
-        av_frame_free(&hwframe_);
-        av_packet_free(&packet_);
-        avcodec_free_context(&avctx_);
+        // keep the context warm for the next session
+        CodecPool::instance().release(pool_key_, avctx_, next_pts_);
+        if (!conf_.stats_file.empty()) {
+            EncoderStats::instance().dump(conf_.stats_file);
+        }
     }
+    av_buffer_unref(&device_ctx_);
+    pending_frames_.clear();
 
     return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -66,7 +138,6 @@ int FFMPEGEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
                   "maxBitrate: {}\n"
                   "maxFramerate: {}\n"
                   "simucastN: {}\n"
-                  "gopsize: {}\n"
                   //"dropEnabled: {}\n"
                   //"encodeComplexity: {}\n"
                   "]",
@@ -76,22 +147,37 @@ int FFMPEGEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
                   codec_settings->minBitrate,   //
                   codec_settings->maxBitrate,   //
                   codec_settings->maxFramerate, //
-                  codec_settings->numberOfSimulcastStreams,
-                  codec_settings->H264().keyFrameInterval
+                  codec_settings->numberOfSimulcastStreams
 
     );
-    if (codec_settings->codecType != VideoCodecType::kVideoCodecH264) {
+    if (codec_settings->codecType != codec_type()) {
         return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
     }
 
+    // a reconfiguration may come without Release()
+    Release();
+    auto init_us = rtc::TimeMicros();
     width_ = codec_settings->width;
     height_ = codec_settings->height;
+    next_pts_ = 0;
+    started_ = false;
+    pool_key_.clear();
+    recovery_pending_ = false;
+    last_key_rtp_.reset();
+    static_frames_ = 0;
+    debt_us_ = 0;
+    last_qp_ = -1;
+    queue_baseline_us_ = -1;
+    last_regions_.clear();
+    if (codec_settings->maxFramerate > 0) {
+        frame_interval_us_ =
+            rtc::kNumMicrosecsPerSec / codec_settings->maxFramerate;
+    }
 
-    auto device = hwac_ ? kDeviceVAAPI : kDeviceX264;
-
-    codec_ = avcodec_find_encoder_by_name(device);
+    codec_ = find_codec();
     if (!codec_) {
-        logger::error("failed to find  encoder: {}", device);
+        logger::error("failed to find encoder for {}",
+                      webrtc::CodecTypeToPayloadString(codec_type()));
         return WEBRTC_VIDEO_CODEC_ERROR;
     }
 
@@ -103,11 +189,10 @@ int FFMPEGEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
 
     avctx_->width = width_;
     avctx_->height = height_;
-    avctx_->pix_fmt = hwac_ ? AV_PIX_FMT_VAAPI : AV_PIX_FMT_YUV420P;
+    avctx_->pix_fmt = hwac_ ? AV_PIX_FMT_VAAPI : sw_format();
     avctx_->framerate = AVRational{60, 1};
     // AVRational{static_cast<int>(codec_settings->maxFramerate), 1};
     avctx_->time_base = av_inv_q(avctx_->framerate);
-    avctx_->gop_size = codec_settings->H264().keyFrameInterval;
     avctx_->max_b_frames = 0;
     avctx_->bit_rate =
         200 * 1000 * 1000;       // codec_settings->startBitrate * 1000;
@@ -116,40 +201,38 @@ int FFMPEGEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
     avctx_->rc_min_rate =
         50 * 1000 * 1000;        // codec_settings->minBitrate * 1000;
     avctx_->global_quality = 10; // 1-100, higher is worse
-    avctx_->profile = FF_PROFILE_H264_HIGH;
-    avctx_->level = 51;          // 5.1
+    if (conf_.frame_vbv && codec_settings->startBitrate > 0) {
+        set_frame_vbv(codec_settings->startBitrate * 1000,
+                      codec_settings->maxFramerate);
+    }
 
-    int ret;
-    if (hwac_) {
-        // constant quality
-        av_opt_set(avctx_->priv_data, "rc_mode", "CQP", 0);
-        ret = av_hwdevice_ctx_create(&device_ctx_, AV_HWDEVICE_TYPE_VAAPI,
-                                     nullptr, nullptr, 0);
-        if (ret < 0) {
-            logger::error("failed to create hardware device context: {}",
-                          av_err2str(ret));
-            return WEBRTC_VIDEO_CODEC_ERROR;
-        }
-        ret = set_hwframe_ctx(avctx_, device_ctx_);
-        if (ret < 0) {
-            logger::error("failed to create hardware frame context: {}",
-                          av_err2str(ret));
-            return WEBRTC_VIDEO_CODEC_ERROR;
-        }
+    int ret = configure(codec_settings);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        return ret;
     }
 
-    ret = avcodec_open2(avctx_, codec_, nullptr);
-    if (ret < 0) {
-        logger::error("failed to open codec: {}", av_err2str(ret));
-        return WEBRTC_VIDEO_CODEC_ERROR;
+    // a warm context of a previous session opened with the same settings
+    auto key = CodecPool::key(
+        avctx_, fmt::format("{}:{}", conf_.slices, conf_.frame_vbv));
+    // and its pts, which must not go backwards
+    auto *warm = CodecPool::instance().acquire(key, &next_pts_);
+    if (warm) {
+        avcodec_free_context(&avctx_);
+        avctx_ = warm;
+    } else {
+        ret = open_context();
+        if (ret != WEBRTC_VIDEO_CODEC_OK) {
+            return ret;
+        }
     }
+    pool_key_ = key;
 
     swframe_ = av_frame_alloc();
     hwframe_ = av_frame_alloc();
     packet_ = av_packet_alloc();
     hwframe_->width = swframe_->width = width_;
     hwframe_->height = swframe_->height = height_;
-    swframe_->format = AV_PIX_FMT_YUV420P;
+    swframe_->format = sw_format();
     ret = av_frame_get_buffer(swframe_, 0);
     if (ret < 0) {
         logger::error("failed to alloc software frame buffer: {}",
@@ -184,7 +267,87 @@ int FFMPEGEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
         av_free(fmts);
     }
 
-    logger::debug("init encoder ok, start encoding");
+    logger::info("init encoder ok in {} ms ({}), start encoding",
+                 (rtc::TimeMicros() - init_us) / 1000, warm ? "warm" : "cold");
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int FFMPEGEncoder::open_context()
+{
+    int ret;
+    if (hwac_) {
+        // constant quality, or constant bitrate within the frame sized buffer
+        av_opt_set(avctx_->priv_data, "rc_mode",
+                   conf_.frame_vbv ? "CBR" : "CQP", 0);
+        device_ctx_ = CodecPool::instance().device(AV_HWDEVICE_TYPE_VAAPI);
+        if (!device_ctx_) {
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+        ret = set_hwframe_ctx(avctx_, device_ctx_);
+        if (ret < 0) {
+            logger::error("failed to create hardware frame context: {}",
+                          av_err2str(ret));
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+    }
+
+    ret = avcodec_open2(avctx_, codec_, nullptr);
+    if (ret < 0) {
+        logger::error("failed to open codec: {}", av_err2str(ret));
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+const AVCodec *FFMPEGEncoder::find_codec()
+{
+    if (hwac_ && i444_) {
+        logger::warn("no 4:4:4 surfaces for {}, fallback to {}", kDeviceVAAPI,
+                     kDeviceX264);
+        hwac_ = false;
+    }
+    if (hwac_) {
+        auto *hw = EncoderCapabilities::Get().find(kDeviceVAAPI);
+        if (!hw || width_ > hw->max_width || height_ > hw->max_height) {
+            logger::warn("{}x{} is out of reach of {}, fallback to {}", width_,
+                         height_, kDeviceVAAPI, kDeviceX264);
+            hwac_ = false;
+        }
+    }
+    auto device = hwac_ ? kDeviceVAAPI : kDeviceX264;
+    return avcodec_find_encoder_by_name(device);
+}
+
+int FFMPEGEncoder::configure(const webrtc::VideoCodec *codec_settings)
+{
+    logger::debug("gopsize: {}", codec_settings->H264().keyFrameInterval);
+    avctx_->gop_size = codec_settings->H264().keyFrameInterval;
+    avctx_->max_b_frames = 0;
+    // the negotiated profile
+    avctx_->profile = profile_level_id_
+                          ? ff_h264_profile(profile_level_id_->profile)
+                          : FF_PROFILE_H264_HIGH;
+    if (!hwac_) {
+        av_opt_set(avctx_->priv_data, "profile",
+                   x264_profile(avctx_->profile), 0);
+    }
+    // the level of what's actually encoded, the negotiated one is what the
+    // backend sustains and may be below the capture resolution
+    auto fps = codec_settings->maxFramerate > 0 ? codec_settings->maxFramerate
+                                                : 60;
+    avctx_->level = static_cast<int>(h264_level(width_, height_, fps));
+    // each slice is packetized as soon as it's written into the access unit,
+    // and the receiver could decode slices in parallel
+    avctx_->slices = std::max(conf_.slices, 1);
+
+    if (!hwac_) {
+        // no lookahead and no frame threading, slices are encoded in parallel
+        // within the current frame instead of delaying output frames
+        // (zerolatency implies sliced-threads)
+        av_opt_set(avctx_->priv_data, "tune", "zerolatency", 0);
+        av_opt_set_int(avctx_->priv_data, "forced-idr", 1, 0);
+    }
+
     return WEBRTC_VIDEO_CODEC_OK;
 }
 
@@ -193,10 +356,40 @@ FFMPEGEncoder::Encode(const webrtc::VideoFrame &frame,
                       const std::vector<webrtc::VideoFrameType> *frame_types)
 {
     int ret;
+    EncoderStats::Frame stats;
+    auto start_us = rtc::TimeMicros();
+    stats.capture_time_us = frame.timestamp_us();
+    stats.queue_us = start_us - frame.timestamp_us();
+    // changes of dropped frames are sent with the next encoded one
+    track_dirty(frame);
+
+    // a pooled context continues the GOP of its previous session
+    bool key = !started_ || recovery_pending_;
+    if (frame_types) {
+        key |= std::find(frame_types->begin(), frame_types->end(),
+                         VideoFrameType::kVideoFrameKey) != frame_types->end();
+    }
+    // never drop a frame the receiver is waiting for
+    if (auto reason = key ? absl::nullopt : drop_reason(stats.queue_us)) {
+        EncoderStats::instance().drop(*reason);
+        callback_->OnDroppedFrame(
+            webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
     AVFrame *inframe = swframe_;
     intoAVFrame(swframe_, frame);
     if (hwac_) {
         inframe = hwframe_;
+        // the encoder may still hold previous surfaces (reordering or async
+        // encoding), so take a fresh one from the pool for every frame
+        av_frame_unref(hwframe_);
+        ret = av_hwframe_get_buffer(avctx_->hw_frames_ctx, hwframe_, 0);
+        if (ret < 0) {
+            logger::error("failed to alloc hardware frame buffer: {}",
+                          av_err2str(ret));
+            return WEBRTC_VIDEO_CODEC_MEMORY;
+        }
         ret = av_hwframe_transfer_data(hwframe_, swframe_, 0);
         if (ret < 0) {
             logger::error("failed to transfer to hardware frame buffer: {}",
@@ -204,8 +397,17 @@ FFMPEGEncoder::Encode(const webrtc::VideoFrame &frame,
             return WEBRTC_VIDEO_CODEC_MEMORY;
         }
     }
+    auto upload_us = rtc::TimeMicros();
+    stats.upload_us = upload_us - start_us;
+
+    inframe->pts = next_pts_;
+    inframe->pict_type = key ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    bool refine = set_regions(inframe, frame);
     ret = avcodec_send_frame(avctx_, inframe);
+    auto sent_us = rtc::TimeMicros();
+    stats.encode_us = sent_us - upload_us;
     if (ret == AVERROR(EAGAIN)) {
+        EncoderStats::instance().drop(EncoderStats::Drop::kBusy);
         callback_->OnDroppedFrame(
             webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
         return WEBRTC_VIDEO_CODEC_TIMEOUT; // ??
@@ -213,26 +415,205 @@ FFMPEGEncoder::Encode(const webrtc::VideoFrame &frame,
         logger::warn("failed to send frame: {}", av_err2str(ret));
         return WEBRTC_VIDEO_CODEC_ENCODER_FAILURE;
     }
+    // the key frame is in the encoder, a rejected one is retried with the
+    // next frame
+    recovery_pending_ = false;
+    started_ = true;
+    // packets may come out in decoding order, keep the source frame until
+    // its packet is received
+    pending_frames_.emplace(next_pts_++, PendingFrame{frame, stats, sent_us,
+                                                      dirty_, key || refine});
+    dirty_ = {0, 0, 0, 0};
 
     while (ret == 0) {
         ret = avcodec_receive_packet(avctx_, packet_);
         if (ret < 0) {
             break;
         }
+        auto source = pending_frames_.find(packet_->pts);
+        if (source == pending_frames_.end()) {
+            logger::warn("no source frame for packet, pts: {}", packet_->pts);
+            continue;
+        }
+        auto &fs = source->second.stats;
+        fs.drain_us = rtc::TimeMicros() - source->second.sent_us;
+
         webrtc::EncodedImage img;
-        intoEncodedImage(img, packet_, frame);
+        intoEncodedImage(img, packet_, source->second.frame);
+
         webrtc::CodecSpecificInfo info;
-        info.codecType = webrtc::kVideoCodecH264;
-        info.codecSpecific.H264.base_layer_sync = false;   //?
-        info.codecSpecific.H264.packetization_mode =
-            webrtc::H264PacketizationMode::NonInterleaved; //?
-        info.codecSpecific.H264.idr_frame =
-            img._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+        fill_codec_specific(info, img, packet_->pts);
+        // ahead of the frame, the viewer looks it up once decoded
+        publish_dirty(source->second, img.qp_);
         auto result = callback_->OnEncodedImage(img, &info);
+
+        fs.rtp_timestamp = img.Timestamp();
+        fs.qp = img.qp_;
+        fs.size = img.size();
+        fs.keyframe = img._frameType == VideoFrameType::kVideoFrameKey;
+        if (fs.keyframe) {
+            last_key_rtp_ = img.Timestamp();
+        }
+        EncoderStats::instance().add(fs);
+        pending_frames_.erase(source);
     }
+
+    // time the encoder queue was busy with this frame beyond its interval
+    debt_us_ = std::max<int64_t>(
+        0, debt_us_ + rtc::TimeMicros() - start_us - frame_interval_us_);
     return WEBRTC_VIDEO_CODEC_OK;
 }
 
+absl::optional<EncoderStats::Drop>
+FFMPEGEncoder::drop_reason(int64_t queue_us)
+{
+    // a steady capture latency is no backlog, the baseline takes the lowest
+    // queue time and slowly follows a lasting rise
+    queue_baseline_us_ =
+        queue_baseline_us_ < 0
+            ? queue_us
+            : std::min(queue_us, queue_baseline_us_ + kQueueDriftUs);
+    absl::optional<EncoderStats::Drop> reason;
+    if (queue_us - queue_baseline_us_ > kMaxQueueFrames * frame_interval_us_) {
+        // a backlog builds up, newer frames are queued behind
+        reason = EncoderStats::Drop::kStale;
+    } else if (debt_us_ > frame_interval_us_) {
+        reason = EncoderStats::Drop::kOverBudget;
+    }
+    // a skipped frame gives its interval back
+    if (reason) {
+        debt_us_ = std::max<int64_t>(0, debt_us_ - frame_interval_us_);
+    }
+    return reason;
+}
+
+void FFMPEGEncoder::fill_codec_specific(webrtc::CodecSpecificInfo &info,
+                                        const webrtc::EncodedImage &image,
+                                        int64_t pts)
+{
+    bool idr = image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+
+    info.codecType = webrtc::kVideoCodecH264;
+    info.codecSpecific.H264.packetization_mode =
+        webrtc::H264PacketizationMode::NonInterleaved; //?
+    info.codecSpecific.H264.idr_frame = idr;
+    info.codecSpecific.H264.temporal_idx = webrtc::kNoTemporalIdx;
+    info.codecSpecific.H264.base_layer_sync = false;
+}
+
+void FFMPEGEncoder::track_dirty(const webrtc::VideoFrame &frame)
+{
+    if (frame.has_update_rect()) {
+        dirty_.Union(frame.update_rect());
+    } else {
+        dirty_ = {0, 0, width_, height_};
+    }
+}
+
+void FFMPEGEncoder::track_regions(
+    const std::vector<AVRegionOfInterest> &regions)
+{
+    auto same = [](const AVRegionOfInterest &a, const AVRegionOfInterest &b) {
+        return a.top == b.top && a.bottom == b.bottom && a.left == b.left &&
+               a.right == b.right && av_cmp_q(a.qoffset, b.qoffset) == 0;
+    };
+    if (std::equal(regions.begin(), regions.end(), last_regions_.begin(),
+                   last_regions_.end(), same)) {
+        return;
+    }
+    if (regions.empty() || last_regions_.empty()) {
+        // the periphery offset spans the whole frame
+        dirty_ = {0, 0, width_, height_};
+    } else {
+        // the periphery is last and the same, only the areas in front of it
+        // moved
+        for (auto *list : {&regions, &last_regions_}) {
+            for (size_t i = 0; i + 1 < list->size(); i++) {
+                auto &r = (*list)[i];
+                dirty_.Union(
+                    {r.left, r.top, r.right - r.left, r.bottom - r.top});
+            }
+        }
+    }
+    last_regions_ = regions;
+}
+
+void FFMPEGEncoder::publish_dirty(const PendingFrame &pending, int qp)
+{
+    auto rect = pending.dirty;
+    // rate control raises the quality of unchanged areas over the frames
+    // after a scene change, and those changes aren't in the capture diffs
+    bool full = pending.full || qp < 0 || qp < last_qp_;
+    last_qp_ = qp;
+    if (full) {
+        rect = {0, 0, width_, height_};
+    } else if (!rect.IsEmpty()) {
+        // whole macroblocks and one around them, deblocking and the motion
+        // vectors of skipped blocks reach past the changed pixels
+        int left = std::max(0, (rect.offset_x / 16 - 1) * 16);
+        int top = std::max(0, (rect.offset_y / 16 - 1) * 16);
+        int right = std::min(
+            width_, ((rect.offset_x + rect.width + 15) / 16 + 1) * 16);
+        int bottom = std::min(
+            height_, ((rect.offset_y + rect.height + 15) / 16 + 1) * 16);
+        rect = {left, top, right - left, bottom - top};
+    }
+    auto timestamp = pending.frame.timestamp();
+    DirtyRects::instance().publish({
+        .timestamp = timestamp,
+        .previous = last_timestamp_,
+        .x = static_cast<uint16_t>(rect.offset_x),
+        .y = static_cast<uint16_t>(rect.offset_y),
+        .width = static_cast<uint16_t>(rect.width),
+        .height = static_cast<uint16_t>(rect.height),
+    });
+    last_timestamp_ = timestamp;
+}
+
+bool FFMPEGEncoder::set_regions(AVFrame *inframe,
+                                const webrtc::VideoFrame &source)
+{
+    // the software frame is reused, drop the offsets of the previous one
+    av_frame_remove_side_data(inframe, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    bool still = source.has_update_rect() && source.update_rect().IsEmpty();
+    static_frames_ = still ? static_frames_ + 1 : 0;
+
+    std::vector<AVRegionOfInterest> regions;
+    bool refine = false;
+    // build the static screen up to near-lossless, skipped macroblocks of
+    // the following frames keep the quality at almost no cost
+    int step = static_frames_ - conf_.refine_after + 1;
+    if (conf_.refine_after > 0 && step >= 1 && step <= kRefineSteps) {
+        regions.push_back({
+            .self_size = sizeof(AVRegionOfInterest),
+            .top = 0,
+            .bottom = height_,
+            .left = 0,
+            .right = width_,
+            .qoffset = AVRational{-step, 2 * kRefineSteps},
+        });
+        refine = true;
+    } else if (conf_.roi) {
+        regions = InterestRegions::instance().regions(width_, height_);
+    }
+    // refinement frames are published in full
+    track_regions(refine ? std::vector<AVRegionOfInterest>{} : regions);
+    if (regions.empty()) {
+        return refine;
+    }
+
+    auto size = regions.size() * sizeof(AVRegionOfInterest);
+    auto *sd = av_frame_new_side_data(
+        inframe, AV_FRAME_DATA_REGIONS_OF_INTEREST, size);
+    if (!sd) {
+        logger::warn("failed to alloc regions of interest");
+        return refine;
+    }
+    memcpy(sd->data, regions.data(), size);
+    return refine;
+}
+
 int32_t FFMPEGEncoder::RegisterEncodeCompleteCallback(
     webrtc::EncodedImageCallback *callback)
 {
@@ -243,9 +624,11 @@ int32_t FFMPEGEncoder::RegisterEncodeCompleteCallback(
 webrtc::VideoEncoder::EncoderInfo FFMPEGEncoder::GetEncoderInfo() const
 {
     EncoderInfo info;
-    info.implementation_name = "h264_hw_encoder";
+    info.implementation_name = implementation_name();
     info.supports_simulcast = false;
-    info.preferred_pixel_formats = {webrtc::VideoFrameBuffer::Type::kI420};
+    info.preferred_pixel_formats = {
+        i444_ ? webrtc::VideoFrameBuffer::Type::kI444
+              : webrtc::VideoFrameBuffer::Type::kI420};
     info.is_hardware_accelerated = hwac_;
 
     return info;
@@ -254,9 +637,34 @@ webrtc::VideoEncoder::EncoderInfo FFMPEGEncoder::GetEncoderInfo() const
 int FFMPEGEncoder::intoAVFrame(AVFrame *swframe,
                                const webrtc::VideoFrame &frame)
 {
+    using Type = webrtc::VideoFrameBuffer::Type;
     auto buffer = frame.video_frame_buffer();
-    assert(buffer->type() == webrtc::VideoFrameBuffer::Type::kI420);
-    auto yuv = buffer->GetI420();
+    const webrtc::PlanarYuv8Buffer *yuv = nullptr;
+    if (i444_) {
+        // e.g. camera frames, or the screen captured at 4:2:0
+        if (buffer->type() != Type::kI444) {
+            auto i420 = buffer->ToI420();
+            auto full = webrtc::I444Buffer::Create(i420->width(),
+                                                   i420->height());
+            libyuv::I420ToI444(
+                i420->DataY(), i420->StrideY(),                  //
+                i420->DataU(), i420->StrideU(),                  //
+                i420->DataV(), i420->StrideV(),                  //
+                full->MutableDataY(), full->StrideY(),           //
+                full->MutableDataU(), full->StrideU(),           //
+                full->MutableDataV(), full->StrideV(),           //
+                i420->width(), i420->height());
+            buffer = full;
+        }
+        yuv = buffer->GetI444();
+    } else {
+        if (buffer->type() != Type::kI420) {
+            buffer = buffer->ToI420();
+        }
+        yuv = buffer->GetI420();
+    }
+    // the encoder reads the planes until the frame is sent
+    input_ = buffer;
     swframe->linesize[0] = yuv->StrideY();
     swframe->linesize[1] = yuv->StrideU();
     swframe->linesize[2] = yuv->StrideV();
@@ -276,8 +684,7 @@ int FFMPEGEncoder::intoEncodedImage(webrtc::EncodedImage &image,
     // rtpfragment? -- no need for libavcodec, see:
     // https://stackoverflow.com/questions/45632432/webrtc-what-is-rtpfragmentationheader-in-encoder-implementation
 
-    h264_bit_stream_parser_.ParseBitstream(image);
-    // image.qp_ = h264_bit_stream_parser_.GetLastSliceQp().value_or(-1);
+    image.qp_ = parse_qp(image, pkt);
     image._encodedWidth = width_;
     image._encodedHeight = height_;
     image._frameType = pkt->flags & AV_PKT_FLAG_KEY
@@ -293,34 +700,21 @@ int FFMPEGEncoder::intoEncodedImage(webrtc::EncodedImage &image,
     return 0;
 }
 
-int FFMPEGEncoder::set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *device_ctx)
+int FFMPEGEncoder::parse_qp(const webrtc::EncodedImage &image,
+                            const AVPacket *pkt)
 {
-    AVBufferRef *hw_frames_ref;
-    AVHWFramesContext *frames_ctx = nullptr;
-    int ret = 0;
+    h264_bit_stream_parser_.ParseBitstream(image);
+    return h264_bit_stream_parser_.GetLastSliceQp().value_or(-1);
+}
 
-    if (!(hw_frames_ref = av_hwframe_ctx_alloc(device_ctx))) {
+int FFMPEGEncoder::set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *device_ctx)
+{
+    // h264_vaapi can't be flushed into `CodecPool`, but its surfaces can
+    ctx->hw_frames_ctx = CodecPool::instance().frames(
+        device_ctx, AV_PIX_FMT_VAAPI, AV_PIX_FMT_NV12, width_, height_, 20);
+    if (!ctx->hw_frames_ctx) {
         logger::error("Failed to create VAAPI frame context.");
-        return -1;
-    }
-    frames_ctx = (AVHWFramesContext *)(hw_frames_ref->data);
-    frames_ctx->format = AV_PIX_FMT_VAAPI;
-    frames_ctx->sw_format = AV_PIX_FMT_NV12;
-    frames_ctx->width = width_;
-    frames_ctx->height = height_;
-    frames_ctx->initial_pool_size = 20;
-    ret = av_hwframe_ctx_init(hw_frames_ref);
-    if (ret < 0) {
-        logger::error("Failed to initialize VAAPI frame context."
-                      "Error code: {}",
-                      av_err2str(ret));
-        av_buffer_unref(&hw_frames_ref);
-        return ret;
+        return AVERROR(ENOMEM);
     }
-    ctx->hw_frames_ctx = av_buffer_ref(hw_frames_ref);
-    if (!ctx->hw_frames_ctx)
-        ret = AVERROR(ENOMEM);
-
-    av_buffer_unref(&hw_frames_ref);
-    return ret;
+    return 0;
 }
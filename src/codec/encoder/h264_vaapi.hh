@@ -1,8 +1,16 @@
 #pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/h264_profile_level_id.h"
 #include "api/video_codecs/sdp_video_format.h"
 #include "api/video_codecs/video_codec.h"
 #include "api/video_codecs/video_encoder.h"
 #include "common_video/h264/h264_bitstream_parser.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "rtc_base/time_utils.h"
+#include "stats/encoder_stats.hh"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -15,8 +23,38 @@ class FFMPEGEncoder : public webrtc::VideoEncoder
     const char *kDeviceVAAPI = "h264_vaapi";
     const char *kDeviceX264 = "libx264";
 
+    struct Config {
+        // slices per frame, each slice is an independent NAL unit
+        int slices = 1;
+        // export per frame telemetry on release if not empty
+        std::string stats_file;
+        // cap every frame to one frame interval's worth of bits at the
+        // target rate, instead of the fixed high quality rates
+        bool frame_vbv = false;
+        // static frames before the unchanged screen is re-encoded at
+        // progressively lower QP, 0 disables refinement
+        int refine_after = 0;
+        // more bits around the viewer's pointer and focused window, see
+        // `InterestRegions`
+        bool roi = false;
+        // send the access units of this H264 Annex B file instead of
+        // encoding, see `PassthroughEncoder`
+        std::string passthrough_file;
+        // offer High 4:4:4 Predictive first, full chroma keeps colored text
+        // sharp, encoded by libx264 only
+        bool i444 = false;
+    };
+
+    // refinement frames from normal to near-lossless quality
+    static constexpr int kRefineSteps = 3;
+    // frames queued this many frame intervals longer than the steady queue
+    // time are dropped unencoded
+    static constexpr int kMaxQueueFrames = 3;
+    // how fast the steady queue time follows a rise, per frame
+    static constexpr int64_t kQueueDriftUs = 1000;
+
   public:
-    FFMPEGEncoder(const webrtc::SdpVideoFormat &format);
+    FFMPEGEncoder(const webrtc::SdpVideoFormat &format, Config conf);
     ~FFMPEGEncoder() override;
     int InitEncode(const webrtc::VideoCodec *codec_settings,
                    const webrtc::VideoEncoder::Settings &settings) override;
@@ -34,24 +72,108 @@ class FFMPEGEncoder : public webrtc::VideoEncoder
 
     void SetRates(const RateControlParameters &parameters) override;
 
+    // RTCP loss notification (goog-lntf) of the receiver
+    void OnLossNotification(const LossNotification &loss) override;
+
+  protected:
+    // codec specific parts, overridden by other codecs sharing the encoding
+    // loop, see `FFMPEGAV1Encoder`
+    virtual webrtc::VideoCodecType codec_type() const
+    {
+        return webrtc::kVideoCodecH264;
+    }
+    virtual const char *implementation_name() const
+    {
+        return "h264_hw_encoder";
+    }
+    virtual const AVCodec *find_codec();
+    // set codec specific options of `avctx_` before opening it
+    virtual int configure(const webrtc::VideoCodec *codec_settings);
+    virtual void fill_codec_specific(webrtc::CodecSpecificInfo &info,
+                                     const webrtc::EncodedImage &image,
+                                     int64_t pts);
+    virtual int parse_qp(const webrtc::EncodedImage &image,
+                         const AVPacket *pkt);
+
+  private:
+    struct PendingFrame {
+        webrtc::VideoFrame frame;
+        EncoderStats::Frame stats;
+        int64_t sent_us;
+        // published with the packet, once its QP is known
+        webrtc::VideoFrame::UpdateRect dirty;
+        bool full;
+    };
+
   private:
     int intoAVFrame(AVFrame *swframe, const webrtc::VideoFrame &frame);
+    // pixel format of the software frames
+    AVPixelFormat sw_format() const
+    {
+        return i444_ ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_YUV420P;
+    }
     int intoEncodedImage(webrtc::EncodedImage &image, const AVPacket *pkt,
                          const webrtc::VideoFrame &frame);
     int set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx);
+    // device, surfaces and avcodec_open2 of a cold `avctx_`
+    int open_context();
+    void set_frame_vbv(int64_t bitrate, double fps);
+    // why a frame queued for `queue_us` should be skipped to keep up
+    absl::optional<EncoderStats::Drop> drop_reason(int64_t queue_us);
+    // QP offsets of `frame` as AV_FRAME_DATA_REGIONS_OF_INTEREST side data,
+    // true if the whole picture is refined
+    bool set_regions(AVFrame *frame, const webrtc::VideoFrame &source);
+    // the area changed since the last encoded frame, see `DirtyRects`
+    void track_dirty(const webrtc::VideoFrame &frame);
+    // areas whose QP offset changed, re-encoded without a change of the source
+    void track_regions(const std::vector<AVRegionOfInterest> &regions);
+    void publish_dirty(const PendingFrame &pending, int qp);
+
+  protected:
+    // properties
+    Config conf_;
+    absl::optional<webrtc::H264ProfileLevelId> profile_level_id_;
+    // internal resources
+    AVCodecContext *avctx_ = nullptr;
+    bool hwac_ = true;
 
   private:
     // external resources
     webrtc::EncodedImageCallback *callback_ = nullptr;
+    // High 4:4:4 Predictive was negotiated
+    bool i444_ = false;
     // internal resources
     webrtc::H264BitstreamParser h264_bit_stream_parser_;
     const AVCodec *codec_ = nullptr;
-    AVCodecContext *avctx_ = nullptr;
+    // planes of the frame in encoding, if converted
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> input_;
     AVFrame *swframe_ = nullptr;
     AVFrame *hwframe_ = nullptr;
     AVPacket *packet_ = nullptr;
     AVBufferRef *device_ctx_ = nullptr;
+    std::string pool_key_;
     int width_ = 0;
     int height_ = 0;
-    bool hwac_ = true;
+    // states
+    // continued from the previous session of a pooled context
+    int64_t next_pts_ = 0;
+    // a frame was sent in this session
+    bool started_ = false;
+    std::map<int64_t, PendingFrame> pending_frames_;
+    // encode the next frame as a key frame to recover from a reported loss
+    bool recovery_pending_ = false;
+    absl::optional<uint32_t> last_key_rtp_;
+    // consecutive frames without updated region
+    int static_frames_ = 0;
+    int64_t frame_interval_us_ = rtc::kNumMicrosecsPerSec / 60;
+    // encode time beyond the frame intervals so far
+    int64_t debt_us_ = 0;
+    // lowest recent capture to encode time, -1 before the first frame
+    int64_t queue_baseline_us_ = -1;
+    // changed since the encoded frame of `last_timestamp_`
+    webrtc::VideoFrame::UpdateRect dirty_ = {0, 0, 0, 0};
+    uint32_t last_timestamp_ = 0;
+    // QP of the last published frame, -1 if unknown
+    int last_qp_ = -1;
+    std::vector<AVRegionOfInterest> last_regions_;
 };
@@ -0,0 +1,182 @@
+#include "passthrough.hh"
+#include "logger.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "common_video/h264/h264_common.h"
+#include "common_video/h264/sps_parser.h"
+#include "modules/video_coding/codecs/interface/common_constants.h"
+#include "modules/video_coding/include/video_error_codes.h"
+
+using webrtc::H264::NaluType;
+
+PassthroughEncoder::PassthroughEncoder(const webrtc::SdpVideoFormat &format,
+                                       std::string path)
+    : path_(std::move(path))
+{
+    logger::debug("create passthrough encoder, format: {}, file: {}",
+                  format.ToString(), path_);
+}
+
+int PassthroughEncoder::InitEncode(
+    const webrtc::VideoCodec *codec_settings,
+    const webrtc::VideoEncoder::Settings &settings)
+{
+    if (codec_settings->codecType != webrtc::kVideoCodecH264) {
+        return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+    }
+    if (units_.empty() && !load()) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    next_ = next_idr(0);
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+bool PassthroughEncoder::load()
+{
+    std::ifstream in(path_, std::ios::binary);
+    if (!in) {
+        logger::error("failed to open passthrough file: {}", path_);
+        return false;
+    }
+    stream_.assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+    units_ = Split(stream_);
+
+    auto idrs = std::count_if(units_.begin(), units_.end(),
+                              [](const auto &au) { return au.idr; });
+    logger::info("passthrough file {}: {} bytes, {} access units, {} idr",
+                 path_, stream_.size(), units_.size(), idrs);
+    if (units_.empty() || idrs == 0) {
+        logger::error("no decodable access unit in {}", path_);
+        units_.clear();
+        return false;
+    }
+    return true;
+}
+
+std::vector<PassthroughEncoder::AccessUnit>
+PassthroughEncoder::Split(const std::vector<uint8_t> &stream)
+{
+    std::vector<AccessUnit> units;
+    // an access unit starts at the first AUD/SPS/PPS/SEI or slice with
+    // first_mb_in_slice == 0 after a slice of the previous one
+    int width = 0, height = 0;
+    bool has_slice = false;
+    for (const auto &n :
+         webrtc::H264::FindNaluIndices(stream.data(), stream.size())) {
+        const uint8_t *p = stream.data() + n.payload_start_offset;
+        if (n.payload_size == 0) {
+            continue;
+        }
+        auto type = webrtc::H264::ParseNaluType(p[0]);
+        bool slice = type == NaluType::kSlice || type == NaluType::kIdr;
+        // ue(v) of 0 is a single 1 bit
+        bool first_slice = slice && n.payload_size > 1 && (p[1] & 0x80);
+        bool delimiter = type == NaluType::kAud || type == NaluType::kSps ||
+                         type == NaluType::kPps || type == NaluType::kSei;
+        if (units.empty() || (has_slice && (delimiter || first_slice))) {
+            units.push_back({n.start_offset, 0, false, width, height});
+            has_slice = false;
+        }
+
+        auto &au = units.back();
+        if (type == NaluType::kSps) {
+            auto sps = webrtc::SpsParser::ParseSps(
+                p + webrtc::H264::kNaluTypeSize,
+                n.payload_size - webrtc::H264::kNaluTypeSize);
+            if (sps) {
+                au.width = width = sps->width;
+                au.height = height = sps->height;
+            }
+        }
+        au.idr |= type == NaluType::kIdr;
+        has_slice |= slice;
+        au.size = n.payload_start_offset + n.payload_size - au.offset;
+    }
+    return units;
+}
+
+size_t PassthroughEncoder::next_idr(size_t from) const
+{
+    for (size_t i = 0; i < units_.size(); i++) {
+        auto n = (from + i) % units_.size();
+        if (units_[n].idr) {
+            return n;
+        }
+    }
+    return from;
+}
+
+int32_t PassthroughEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback *callback)
+{
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::Release()
+{
+    stream_.clear();
+    units_.clear();
+    next_ = 0;
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t
+PassthroughEncoder::Encode(const webrtc::VideoFrame &frame,
+                           const std::vector<webrtc::VideoFrameType> *frame_types)
+{
+    if (units_.empty() || !callback_) {
+        return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+
+    // key frame requests skip ahead to the next IDR
+    if (frame_types &&
+        std::find(frame_types->begin(), frame_types->end(),
+                  webrtc::VideoFrameType::kVideoFrameKey) !=
+            frame_types->end()) {
+        next_ = next_idr(next_);
+    }
+    const auto &au = units_[next_];
+    // restart from the first IDR, the decoder has no references across the
+    // loop
+    next_ = next_ + 1 < units_.size() ? next_ + 1 : next_idr(0);
+
+    webrtc::EncodedImage image;
+    image.SetEncodedData(webrtc::EncodedImageBuffer::Create(
+        stream_.data() + au.offset, au.size));
+    h264_bit_stream_parser_.ParseBitstream(image);
+    image.qp_ = h264_bit_stream_parser_.GetLastSliceQp().value_or(-1);
+    image._encodedWidth = au.width ? au.width : frame.width();
+    image._encodedHeight = au.height ? au.height : frame.height();
+    image._frameType = au.idr ? webrtc::VideoFrameType::kVideoFrameKey
+                              : webrtc::VideoFrameType::kVideoFrameDelta;
+    image.ntp_time_ms_ = frame.ntp_time_ms();
+    image.capture_time_ms_ = frame.render_time_ms();
+    image.rotation_ = frame.rotation();
+    image.content_type_ = webrtc::VideoContentType::SCREENSHARE;
+    image.SetTimestamp(frame.timestamp());
+
+    webrtc::CodecSpecificInfo info;
+    info.codecType = webrtc::kVideoCodecH264;
+    info.codecSpecific.H264.packetization_mode =
+        webrtc::H264PacketizationMode::NonInterleaved;
+    info.codecSpecific.H264.idr_frame = au.idr;
+    info.codecSpecific.H264.temporal_idx = webrtc::kNoTemporalIdx;
+    info.codecSpecific.H264.base_layer_sync = false;
+    callback_->OnEncodedImage(image, &info);
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+webrtc::VideoEncoder::EncoderInfo PassthroughEncoder::GetEncoderInfo() const
+{
+    EncoderInfo info;
+    info.implementation_name = "h264_passthrough";
+    info.supports_simulcast = false;
+    info.is_hardware_accelerated = false;
+    info.preferred_pixel_formats = {webrtc::VideoFrameBuffer::Type::kI420};
+    return info;
+}
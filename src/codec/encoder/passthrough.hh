@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_codec.h"
+#include "api/video_codecs/video_encoder.h"
+#include "common_video/h264/h264_bitstream_parser.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+
+// Sends the access units of a pre-recorded H264 Annex B file instead of
+// encoding, one per input frame, to benchmark the transport without encode
+// cost. Loops at the end of the file.
+class PassthroughEncoder : public webrtc::VideoEncoder
+{
+  public:
+    struct AccessUnit {
+        size_t offset;
+        size_t size;
+        bool idr;
+        int width;
+        int height;
+    };
+
+  public:
+    // the access units of an Annex B stream, with the resolution of the SPS
+    // before them, 0 if there is none
+    static std::vector<AccessUnit> Split(const std::vector<uint8_t> &stream);
+
+    PassthroughEncoder(const webrtc::SdpVideoFormat &format, std::string path);
+    ~PassthroughEncoder() override = default;
+
+    int InitEncode(const webrtc::VideoCodec *codec_settings,
+                   const webrtc::VideoEncoder::Settings &settings) override;
+
+    int32_t RegisterEncodeCompleteCallback(
+        webrtc::EncodedImageCallback *callback) override;
+
+    int32_t Release() override;
+
+    int32_t
+    Encode(const webrtc::VideoFrame &frame,
+           const std::vector<webrtc::VideoFrameType> *frame_types) override;
+
+    EncoderInfo GetEncoderInfo() const override;
+
+    void SetRates(const RateControlParameters &parameters) override {}
+
+  private:
+    bool load();
+    size_t next_idr(size_t from) const;
+
+  private:
+    // properties
+    std::string path_;
+    // external resources
+    webrtc::EncodedImageCallback *callback_ = nullptr;
+    // internal resources
+    webrtc::H264BitstreamParser h264_bit_stream_parser_;
+    std::vector<uint8_t> stream_;
+    std::vector<AccessUnit> units_;
+    // states
+    size_t next_ = 0;
+};
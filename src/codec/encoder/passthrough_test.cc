@@ -0,0 +1,38 @@
+#include "passthrough.hh"
+
+#include <cassert>
+#include <cstdio>
+
+int main(int argc, char *argv[])
+{
+    // first_mb_in_slice is 0 if the first payload bit is set
+    const std::vector<uint8_t> aud = {0, 0, 0, 1, 0x09, 0xf0};
+    const std::vector<uint8_t> idr = {0, 0, 0, 1, 0x65, 0x88, 0x84};
+    const std::vector<uint8_t> idr_next = {0, 0, 1, 0x65, 0x40, 0x84};
+    const std::vector<uint8_t> p = {0, 0, 0, 1, 0x41, 0x9a, 0x02};
+
+    std::vector<uint8_t> stream;
+    for (const auto *nalu : {&aud, &idr, &idr_next, &p, &aud, &p}) {
+        stream.insert(stream.end(), nalu->begin(), nalu->end());
+    }
+
+    auto units = PassthroughEncoder::Split(stream);
+    assert(units.size() == 3);
+    // the second slice of the IDR picture, a P slice, and an AUD before one
+    assert(units[0].offset == 0);
+    assert(units[0].size == aud.size() + idr.size() + idr_next.size());
+    assert(units[0].idr);
+    assert(units[1].offset == units[0].size);
+    assert(units[1].size == p.size());
+    assert(!units[1].idr);
+    assert(units[2].offset == units[1].offset + units[1].size);
+    assert(units[2].size == aud.size() + p.size());
+    assert(!units[2].idr);
+    // no SPS, the resolution is unknown
+    assert(units[0].width == 0 && units[0].height == 0);
+
+    assert(PassthroughEncoder::Split({}).empty());
+
+    std::printf("passthrough tests passed\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "regions.hh"
+
+#include <algorithm>
+
+#include "rtc_base/time_utils.h"
+
+// fractions of the QP range, negative is better quality
+static const AVRational kPointerOffset = {-1, 5};
+static const AVRational kFocusOffset = {-1, 10};
+static const AVRational kPeripheryOffset = {1, 10};
+
+static AVRegionOfInterest to_region(const InterestRegions::Rect &r, int width,
+                                    int height, AVRational qoffset)
+{
+    auto clamp = [](double v) { return std::clamp(v, 0.0, 1.0); };
+    return {
+        .self_size = sizeof(AVRegionOfInterest),
+        .top = static_cast<int>(clamp(r.top) * height),
+        .bottom = static_cast<int>(clamp(r.bottom) * height),
+        .left = static_cast<int>(clamp(r.left) * width),
+        .right = static_cast<int>(clamp(r.right) * width),
+        .qoffset = qoffset,
+    };
+}
+
+InterestRegions &InterestRegions::instance()
+{
+    static InterestRegions regions;
+    return regions;
+}
+
+void InterestRegions::set_pointer(double x, double y)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    pointer_ = Rect{x - kPointerRadius, y - kPointerRadius, x + kPointerRadius,
+                    y + kPointerRadius};
+    pointer_ms_ = rtc::TimeMillis();
+}
+
+void InterestRegions::set_focus(const Rect &rect)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    focus_ = rect;
+    focus_ms_ = rtc::TimeMillis();
+}
+
+std::vector<AVRegionOfInterest> InterestRegions::regions(int width,
+                                                         int height) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<AVRegionOfInterest> result;
+    auto now = rtc::TimeMillis();
+    if (pointer_ && now - pointer_ms_ < kStaleMs) {
+        result.push_back(to_region(*pointer_, width, height, kPointerOffset));
+    }
+    if (focus_ && now - focus_ms_ < kStaleMs) {
+        result.push_back(to_region(*focus_, width, height, kFocusOffset));
+    }
+    // nobody is interacting, keep the quality even
+    if (result.empty()) {
+        return result;
+    }
+    result.push_back(
+        to_region(Rect{0, 0, 1, 1}, width, height, kPeripheryOffset));
+    return result;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Where the viewer is looking at, fed by remote input events and turned into
+// QP offsets by the encoder. Coordinates are normalized to [0, 1] of the
+// shared screen, so they don't depend on the encoded resolution.
+class InterestRegions
+{
+  public:
+    struct Rect {
+        double left = 0;
+        double top = 0;
+        double right = 0;
+        double bottom = 0;
+    };
+
+    // a pointer which hasn't moved for this long is ignored, as is a focus
+    // which hasn't been refreshed, e.g. no window has it
+    static constexpr int64_t kStaleMs = 3000;
+    // half size of the square around the pointer
+    static constexpr double kPointerRadius = 0.06;
+
+  public:
+    static InterestRegions &instance();
+
+    void set_pointer(double x, double y);
+    void set_focus(const Rect &rect);
+
+    // pointer area, focused window and the periphery of a `width`x`height`
+    // frame, in order of precedence
+    std::vector<AVRegionOfInterest> regions(int width, int height) const;
+
+  private:
+    mutable std::mutex mutex_;
+    std::optional<Rect> pointer_;
+    std::optional<Rect> focus_;
+    int64_t pointer_ms_ = 0;
+    int64_t focus_ms_ = 0;
+};
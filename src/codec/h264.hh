@@ -1,15 +1,64 @@
 #pragma once
 #include "modules/video_coding/codecs/h264/include/h264.h"
 
-static inline constexpr webrtc::ScalabilityMode IkSupportedScalabilityModes[] =
-    {webrtc::ScalabilityMode::kL1T1, webrtc::ScalabilityMode::kL1T2,
-     webrtc::ScalabilityMode::kL1T3};
+// the lowest level whose frame size and macroblock rate cover `width`x`height`
+// at `fps`, 5.2 for anything larger
+static inline webrtc::H264Level h264_level(int width, int height, double fps)
+{
+    using webrtc::H264Level;
+    // MaxFS and MaxMBPS of Table A-1
+    static constexpr struct {
+        H264Level level;
+        int max_fs;
+        int max_mbps;
+    } kLimits[] = {
+        {H264Level::kLevel1, 99, 1485},
+        {H264Level::kLevel1_1, 396, 3000},
+        {H264Level::kLevel1_2, 396, 6000},
+        {H264Level::kLevel1_3, 396, 11880},
+        {H264Level::kLevel2, 396, 11880},
+        {H264Level::kLevel2_1, 792, 19800},
+        {H264Level::kLevel2_2, 1620, 20250},
+        {H264Level::kLevel3, 1620, 40500},
+        {H264Level::kLevel3_1, 3600, 108000},
+        {H264Level::kLevel3_2, 5120, 216000},
+        {H264Level::kLevel4, 8192, 245760},
+        {H264Level::kLevel4_1, 8192, 245760},
+        {H264Level::kLevel4_2, 8704, 522240},
+        {H264Level::kLevel5, 22080, 589824},
+        {H264Level::kLevel5_1, 36864, 983040},
+    };
+    int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+    for (const auto &limit : kLimits) {
+        if (mbs <= limit.max_fs && mbs * fps <= limit.max_mbps) {
+            return limit.level;
+        }
+    }
+    return H264Level::kLevel5_2;
+}
 
+// full chroma, for text and UI lines without color fringes
 static inline std::vector<webrtc::SdpVideoFormat>
-supported_h264_codecs(bool mode)
+supported_h264_444_codecs(bool mode)
 {
-    // TODO: vainfo?
     return {
+        webrtc::CreateH264Format(webrtc::H264Profile::kProfilePredictiveHigh444,
+                                 webrtc::H264Level::kLevel5_1, "1", mode),
+        webrtc::CreateH264Format(webrtc::H264Profile::kProfilePredictiveHigh444,
+                                 webrtc::H264Level::kLevel5_1, "0", mode),
+    };
+}
+
+// High 4:4:4 Predictive formats come first if `i444`, peers that can't decode
+// them negotiate one of the 4:2:0 profiles instead
+static inline std::vector<webrtc::SdpVideoFormat>
+supported_h264_codecs(bool mode, bool i444 = false)
+{
+    std::vector<webrtc::SdpVideoFormat> formats;
+    if (i444) {
+        formats = supported_h264_444_codecs(mode);
+    }
+    std::vector<webrtc::SdpVideoFormat> yuv420 = {
         webrtc::CreateH264Format(webrtc::H264Profile::kProfileBaseline,
                                  webrtc::H264Level::kLevel3_1, "1", mode),
         webrtc::CreateH264Format(webrtc::H264Profile::kProfileBaseline,
@@ -29,4 +78,6 @@ supported_h264_codecs(bool mode)
         webrtc::CreateH264Format(webrtc::H264Profile::kProfileHigh,
                                  webrtc::H264Level::kLevel5_1, "0", mode),
     };
+    formats.insert(formats.end(), yuv420.begin(), yuv420.end());
+    return formats;
 }
@@ -0,0 +1,138 @@
+#include "pool.hh"
+#include "logger.hh"
+
+#ifdef _MSC_VER
+#undef av_err2str
+#define av_err2str(r) (r)
+#endif
+
+CodecPool &CodecPool::instance()
+{
+    static CodecPool pool;
+    return pool;
+}
+
+CodecPool::~CodecPool() { clear(); }
+
+std::string CodecPool::key(const AVCodecContext *ctx, const std::string &extra)
+{
+    return fmt::format("{}:{}x{}:fmt{}:p{}:l{}:g{}:b{}:s{}:t{}{}:{}",
+                       ctx->codec->name, ctx->width, ctx->height,
+                       static_cast<int>(ctx->pix_fmt), ctx->profile,
+                       ctx->level, ctx->gop_size, ctx->max_b_frames,
+                       ctx->slices, ctx->thread_type, ctx->thread_count,
+                       extra);
+}
+
+AVBufferRef *CodecPool::device(AVHWDeviceType type)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &dev = devices_[type];
+    if (!dev) {
+        int ret = av_hwdevice_ctx_create(&dev, type, nullptr, nullptr, 0);
+        if (ret < 0) {
+            logger::error("failed to create hardware device context: {}",
+                          av_err2str(ret));
+            devices_.erase(type);
+            return nullptr;
+        }
+    }
+    return av_buffer_ref(dev);
+}
+
+AVBufferRef *CodecPool::frames(AVBufferRef *device, AVPixelFormat format,
+                               AVPixelFormat sw_format, int width, int height,
+                               int pool_size)
+{
+    auto key = fmt::format("{}:{}:{}x{}:{}", static_cast<int>(format),
+                           static_cast<int>(sw_format), width, height,
+                           pool_size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    // only referenced by the pool, the session using it is gone
+    auto range = frames_.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (av_buffer_get_ref_count(it->second) == 1) {
+            logger::debug("reuse surface pool {}", key);
+            return av_buffer_ref(it->second);
+        }
+    }
+
+    auto *ref = av_hwframe_ctx_alloc(device);
+    if (!ref) {
+        return nullptr;
+    }
+    auto *ctx = reinterpret_cast<AVHWFramesContext *>(ref->data);
+    ctx->format = format;
+    ctx->sw_format = sw_format;
+    ctx->width = width;
+    ctx->height = height;
+    ctx->initial_pool_size = pool_size;
+    int ret = av_hwframe_ctx_init(ref);
+    if (ret < 0) {
+        logger::error("failed to init surface pool {}: {}", key,
+                      av_err2str(ret));
+        av_buffer_unref(&ref);
+        return nullptr;
+    }
+    // the sessions running in parallel, e.g. tiles, each have their own
+    if (frames_.count(key) < kMaxIdle) {
+        frames_.emplace(key, av_buffer_ref(ref));
+    }
+    return ref;
+}
+
+AVCodecContext *CodecPool::acquire(const std::string &key, int64_t *next_pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = contexts_.find(key);
+    if (it == contexts_.end()) {
+        return nullptr;
+    }
+    auto *ctx = it->second.ctx;
+    if (next_pts) {
+        *next_pts = it->second.next_pts;
+    }
+    contexts_.erase(it);
+    logger::debug("reuse codec context {}", key);
+    return ctx;
+}
+
+void CodecPool::release(const std::string &key, AVCodecContext *&ctx,
+                        int64_t next_pts)
+{
+    if (!ctx) {
+        return;
+    }
+
+    // encoders drop the queued frames and restart the GOP, decoders forget
+    // the references. The others keep their device and surfaces in the pool.
+    bool flushable = !av_codec_is_encoder(ctx->codec) ||
+                     ctx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH;
+    if (flushable && !key.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (contexts_.count(key) < kMaxIdle) {
+            avcodec_flush_buffers(ctx);
+            contexts_.emplace(key, Idle{ctx, next_pts});
+            ctx = nullptr;
+            return;
+        }
+    }
+    avcodec_free_context(&ctx);
+}
+
+void CodecPool::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[_, idle] : contexts_) {
+        avcodec_free_context(&idle.ctx);
+    }
+    contexts_.clear();
+    for (auto &[_, ref] : frames_) {
+        av_buffer_unref(&ref);
+    }
+    frames_.clear();
+    for (auto &[_, dev] : devices_) {
+        av_buffer_unref(&dev);
+    }
+    devices_.clear();
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+}
+
+// Process wide cache of opened codec contexts and hardware devices, so a new
+// session skips device creation, surface pool allocation and avcodec_open2.
+// Contexts are keyed by everything they were opened with, see `key()`.
+// Encoders which can't be flushed (h264_vaapi) are opened again, on a pooled
+// device and surface pool, see `frames()`.
+class CodecPool
+{
+  public:
+    // idle contexts kept per key
+    static constexpr size_t kMaxIdle = 2;
+
+  public:
+    static CodecPool &instance();
+    ~CodecPool();
+
+    // codec name, resolution and the options which can't change once opened
+    static std::string key(const AVCodecContext *ctx, const std::string &extra);
+
+    // a new reference to the shared device of `type`, nullptr on failure
+    AVBufferRef *device(AVHWDeviceType type);
+    // a new reference to an idle surface pool of `device` with these
+    // surfaces, allocated if there is none, nullptr on failure
+    AVBufferRef *frames(AVBufferRef *device, AVPixelFormat format,
+                        AVPixelFormat sw_format, int width, int height,
+                        int pool_size);
+    // a flushed context opened with `key`, nullptr if there is none.
+    // `next_pts` is set to the one it was released with.
+    AVCodecContext *acquire(const std::string &key,
+                            int64_t *next_pts = nullptr);
+    // flush `ctx` and keep it for the next session, it's freed instead if the
+    // codec can't be flushed or there are enough idle ones. Encoders pass the
+    // pts their next frame needs, as the pts must keep increasing.
+    void release(const std::string &key, AVCodecContext *&ctx,
+                 int64_t next_pts = 0);
+    void clear();
+
+  private:
+    CodecPool() = default;
+
+  private:
+    struct Idle {
+        AVCodecContext *ctx;
+        int64_t next_pts;
+    };
+
+    std::mutex mutex_;
+    std::map<AVHWDeviceType, AVBufferRef *> devices_;
+    std::multimap<std::string, AVBufferRef *> frames_;
+    std::multimap<std::string, Idle> contexts_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 
 #include <SDL2/SDL_events.h>
 
@@ -17,6 +18,13 @@ class EventExecutor
         int x;
         int y;
     };
+    // normalized to [0, 1] of the screen
+    struct Area {
+        double left;
+        double top;
+        double right;
+        double bottom;
+    };
     static auto create(int w, int h, int rw, int rh)
         -> std::unique_ptr<EventExecutor>;
 
@@ -24,6 +32,8 @@ class EventExecutor
     EventExecutor(int w, int h, int rw, int rh);
     ~EventExecutor() = default;
     auto execute(Event) -> bool;
+    // the window which has the input focus
+    auto focused_area() -> std::optional<Area>;
     // auto mouse_move();
     // auto mouse_click();
     // auto key_down();
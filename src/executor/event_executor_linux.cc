@@ -202,4 +202,21 @@ auto EventExecutor::execute(EventExecutor::Event ev) -> bool
     return true;
 }
 
+auto EventExecutor::focused_area() -> std::optional<EventExecutor::Area>
+{
+    Window win;
+    int x, y, mx, my, screen_num;
+    unsigned int w, h, sw, sh;
+    if (xdo_get_mouse_location(xdo_, &mx, &my, &screen_num) != XDO_SUCCESS ||
+        xdo_get_focused_window_sane(xdo_, &win) != XDO_SUCCESS ||
+        xdo_get_window_location(xdo_, win, &x, &y, nullptr) != XDO_SUCCESS ||
+        xdo_get_window_size(xdo_, win, &w, &h) != XDO_SUCCESS ||
+        xdo_get_viewport_dimensions(xdo_, &sw, &sh, screen_num) !=
+            XDO_SUCCESS ||
+        sw == 0 || sh == 0) {
+        return {};
+    }
+    return Area{double(x) / sw, double(y) / sh, double(x + w) / sw,
+                double(y + h) / sh};
+}
 #endif
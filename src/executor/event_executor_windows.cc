@@ -255,4 +255,16 @@ auto EventExecutor::execute(EventExecutor::Event ev) -> bool
     return true;
 }
 
+auto EventExecutor::focused_area() -> std::optional<EventExecutor::Area>
+{
+    RECT rect;
+    HWND win = GetForegroundWindow();
+    double sw = GetSystemMetrics(SM_CXSCREEN);
+    double sh = GetSystemMetrics(SM_CYSCREEN);
+    if (!win || !GetWindowRect(win, &rect) || sw == 0 || sh == 0) {
+        return {};
+    }
+    return Area{rect.left / sw, rect.top / sh, rect.right / sw,
+                rect.bottom / sh};
+}
 #endif
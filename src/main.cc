@@ -10,9 +10,17 @@
 #include <fmt/format.h>
 
 #include "rtc_base/logging.h"
+#include "system_wrappers/include/field_trial.h"
 
 ABSL_FLAG(bool, rtclog, false, "enable webrtc debug level logging");
 ABSL_FLAG(bool, debug, false, "enable verbose logging");
+ABSL_FLAG(bool, loss_notification, false,
+          "negotiate RTCP loss notification, so the encoder only recovers "
+          "when the receiver can't decode, with --use_h264 only");
+
+// must outlive all webrtc objects
+static const char kLossNotificationTrial[] =
+    "WebRTC-RtcpLossNotification/Enabled/";
 
 int main(int argc, char *argv[])
 {
@@ -24,8 +32,15 @@ int main(int argc, char *argv[])
     logger::set_level(absl::GetFlag(FLAGS_debug) ? spdlog::level::trace
                                                  : spdlog::level::debug);
     logger::info("Hello dezk");
+    // the trial is process wide, the built-in codecs keep their defaults
+    if (absl::GetFlag(FLAGS_loss_notification) && MainWindow::custom_codecs()) {
+        webrtc::field_trial::InitFieldTrialsFromString(kLossNotificationTrial);
+    }
 
-    if (SDL_Init(SDL_INIT_EVERYTHING) || TTF_Init()) {
+    // no windows without a UI, and maybe no display to open them on
+    auto subsystems = MainWindow::headless() ? SDL_INIT_EVENTS | SDL_INIT_TIMER
+                                             : SDL_INIT_EVERYTHING;
+    if (SDL_Init(subsystems) || TTF_Init()) {
         logger::critical("failed to init SDL or SDL_TTF: {}", SDL_GetError());
         exit(EXIT_FAILURE);
     }
@@ -1,7 +1,10 @@
 #include "main_window.hh"
+#include "codec/encoder/capabilities.hh"
+#include "codec/encoder/regions.hh"
 #include "executor/event_executor.hh"
 #include "ui/sdl_trigger.hh"
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <thread>
@@ -20,13 +23,16 @@ static const VideoRenderer::Config camwin_opts = {.name = "camera video",
                                                   .height = 400,
                                                   .use_opengl = false,
                                                   .dump = false,
-                                                  .hide = true};
+                                                  .hide = true,
+                                                  .render_thread = true};
 static const VideoRenderer::Config capwin_opts = {.name = "remote desktop",
                                                   .width = 1920,
                                                   .height = 1200,
                                                   .use_opengl = true,
                                                   .dump = false,
-                                                  .hide = true};
+                                                  .hide = true,
+                                                  .render_thread = true,
+                                                  .stats = true};
 static const ScreenCapturer::Config capture_opts = {.fps = 60,
                                                     .width = 2560,
                                                     .height = 1600,
@@ -40,6 +46,44 @@ ABSL_FLAG(int, port, 8888, "signal server port");
 ABSL_FLAG(bool, auto_login, true, "auto login");
 ABSL_FLAG(bool, use_opengl, true, "use OpenGL instead of SDL2");
 ABSL_FLAG(bool, use_h264, false, "use custom H264 codec implementation");
+ABSL_FLAG(std::string, codec, "video/H264",
+          "preferred video codec of custom implementation, e.g. video/AV1");
+ABSL_FLAG(int, slices, 4, "slices per encoded frame of custom H264 encoder");
+ABSL_FLAG(bool, frame_vbv, false,
+          "cap each encoded frame to one frame interval at the target rate");
+ABSL_FLAG(int, refine_after, 30,
+          "static frames before the screen is refined to near-lossless, "
+          "0 disables");
+ABSL_FLAG(bool, roi, false,
+          "spend more bits around the viewer's pointer and focused window");
+ABSL_FLAG(int, tile_columns, 1,
+          "split the screen into a grid of tracks with their own encoders, "
+          "e.g. for 5K/8K desktops, must be the same on both sides");
+ABSL_FLAG(int, tile_rows, 1, "rows of the screen tile grid");
+ABSL_FLAG(bool, i444, false,
+          "capture and encode the screen with full chroma (H264 High 4:4:4), "
+          "if the peer can decode it");
+ABSL_FLAG(bool, dirty_rects, false,
+          "ask the sharer which area of each frame changed and upload only "
+          "that to the GPU");
+ABSL_FLAG(int, decoder_threads, 0,
+          "slice threads of the custom H264 decoder, 0 for one per core");
+ABSL_FLAG(bool, decoder_fast, false,
+          "allow non spec compliant speedups of the custom H264 decoder");
+ABSL_FLAG(int, swap_interval, 1,
+          "remote desktop presentation, 1 vsync, -1 adaptive vsync, 0 "
+          "immediate");
+ABSL_FLAG(std::vector<std::string>, null_sink, std::vector<std::string>(),
+          "drop the remote desktop frames instead of showing them, for "
+          "benchmarks without a display: count, checksum, offscreen and/or "
+          "readback");
+ABSL_FLAG(std::string, connect, "",
+          "without a UI (--null_sink), view this peer once it's online");
+ABSL_FLAG(std::string, passthrough, "",
+          "send this pre-recorded H264 Annex B file instead of encoding, "
+          "for transport benchmarks");
+ABSL_FLAG(std::string, encoder_stats, "",
+          "export per frame encoder telemetry to this csv file");
 ABSL_FLAG(std::vector<std::string>, servers,
           std::vector<std::string>({
               "stun:stun1.l.google.com:19302",
@@ -48,35 +92,90 @@ ABSL_FLAG(std::vector<std::string>, servers,
           }),
           "stun servers");
 
-MainWindow::MainWindow(int argc, char *argv[]) : app_(App::create())
+bool MainWindow::headless()
 {
+    return !absl::GetFlag(FLAGS_null_sink).empty();
+}
+
+bool MainWindow::custom_codecs() { return absl::GetFlag(FLAGS_use_h264); }
+
+MainWindow::MainWindow(int argc, char *argv[])
+{
+    headless_ = headless();
     need_login_ = absl::GetFlag(FLAGS_auto_login);
     chatbuf_.reserve(6400);
 
     pc_conf_.stun_servers = absl::GetFlag(FLAGS_servers);
     pc_conf_.use_codec = absl::GetFlag(FLAGS_use_h264);
+    pc_conf_.video_codec = absl::GetFlag(FLAGS_codec);
+    pc_conf_.encoder.slices = absl::GetFlag(FLAGS_slices);
+    pc_conf_.encoder.stats_file = absl::GetFlag(FLAGS_encoder_stats);
+    pc_conf_.encoder.frame_vbv = absl::GetFlag(FLAGS_frame_vbv);
+    pc_conf_.encoder.refine_after = absl::GetFlag(FLAGS_refine_after);
+    pc_conf_.encoder.passthrough_file = absl::GetFlag(FLAGS_passthrough);
+    pc_conf_.decoder.threads = absl::GetFlag(FLAGS_decoder_threads);
+    pc_conf_.decoder.fast = absl::GetFlag(FLAGS_decoder_fast);
+    pc_conf_.tile_columns = std::max(absl::GetFlag(FLAGS_tile_columns), 1);
+    pc_conf_.tile_rows = std::max(absl::GetFlag(FLAGS_tile_rows), 1);
+    // regions are in whole screen coordinates, an encoder doesn't know which
+    // tile it encodes
+    pc_conf_.encoder.roi = absl::GetFlag(FLAGS_roi) &&
+                           pc_conf_.tile_columns * pc_conf_.tile_rows == 1;
+    // tiles are cropped from I420 frames
+    pc_conf_.encoder.i444 = absl::GetFlag(FLAGS_i444) && pc_conf_.use_codec &&
+                            pc_conf_.tile_columns * pc_conf_.tile_rows == 1;
+    // tiles are composed on the CPU, and only the custom codecs know the
+    // changed areas
+    pc_conf_.dirty_rects = absl::GetFlag(FLAGS_dirty_rects) &&
+                           pc_conf_.use_codec &&
+                           pc_conf_.tile_columns * pc_conf_.tile_rows == 1;
+    pc_conf_.input_width = capwin_opts.width;
+    pc_conf_.input_height = capwin_opts.height;
     cc_conf_.host = absl::GetFlag(FLAGS_host);
     cc_conf_.port = absl::GetFlag(FLAGS_port);
     cc_conf_.name = absl::GetFlag(FLAGS_user);
 
-    app_ = App::create();
-    global().set_user(slint::SharedString(cc_conf_.name));
-    global().set_host(slint::SharedString(absl::GetFlag(FLAGS_host)));
-    global().set_port(
-        slint::SharedString::from_number(absl::GetFlag(FLAGS_port)));
-    global().on_login([this] { login(); });
-    global().on_logout([this] { logout(); });
-    global().on_exit([this] { stop(); });
-    global().on_connect([this](const auto &id) { connect(id.data()); });
-    global().on_disconnect([this] { disconnect(); });
-
-    app_->show();
+    if (!headless_) {
+        app_ = App::create();
+        global().set_user(slint::SharedString(cc_conf_.name));
+        global().set_host(slint::SharedString(absl::GetFlag(FLAGS_host)));
+        global().set_port(
+            slint::SharedString::from_number(absl::GetFlag(FLAGS_port)));
+        global().on_login([this] { login(); });
+        global().on_logout([this] { logout(); });
+        global().on_exit([this] { stop(); });
+        global().on_connect([this](const auto &id) { connect(id.data()); });
+        global().on_disconnect([this] { disconnect(); });
+
+        (*app_)->show();
+    }
 
     // TODO: delay heavy works
+    if (pc_conf_.use_codec && pc_conf_.encoder.passthrough_file.empty()) {
+        // the formats of the first offer wait for it, not the UI
+        EncoderCapabilities::Prefetch(capture_opts.width, capture_opts.height);
+    }
     pc_ = std::make_unique<PeerClient>(pc_conf_);
     cc_ = std::make_unique<SignalClient>(ioctx_, cc_conf_);
-    screen_renderer_ = VideoRenderer::Create(capwin_opts);
-    screen_video_src_ = ScreenCapturer::Create(capture_opts);
+    auto capwin_conf = capwin_opts;
+    capwin_conf.swap_interval = absl::GetFlag(FLAGS_swap_interval);
+    auto null_sink = absl::GetFlag(FLAGS_null_sink);
+    if (null_sink.empty()) {
+        screen_renderer_ = VideoRenderer::Create(capwin_conf);
+    } else {
+        auto has = [&null_sink](const char *opt) {
+            return std::find(null_sink.begin(), null_sink.end(), opt) !=
+                   null_sink.end();
+        };
+        screen_null_sink_ = NullSink::Create({
+            .checksum = has("checksum"),
+            .offscreen = has("offscreen"),
+            .readback = has("readback"),
+        });
+    }
+    auto capture_conf = capture_opts;
+    capture_conf.i444 = pc_conf_.encoder.i444;
+    screen_video_src_ = ScreenCapturer::Create(capture_conf);
 
     ee_ = EventExecutor::create(capwin_opts.width, capwin_opts.height,
                                 capture_opts.width, capture_opts.height);
@@ -88,9 +187,14 @@ MainWindow::MainWindow(int argc, char *argv[]) : app_(App::create())
     pc_->set_stats_observer(stats_observer_.get());
 
     pc_->add_screen_video_source(screen_video_src_);
-    pc_->add_screen_sinks(screen_renderer_);
+    if (screen_renderer_) {
+        pc_->add_screen_sinks(screen_renderer_);
+    } else {
+        pc_->add_screen_sinks(screen_null_sink_);
+    }
     auto cameras = CameraCapturer::GetDeviceList();
-    if (!cameras.empty()) {
+    // nowhere to show the camera without a display
+    if (!headless_ && !cameras.empty()) {
         logger::info("supported cameras: {}", cameras);
         auto opts = camera_opts;
         opts.uniq = cameras[0].second.c_str();
@@ -104,11 +208,18 @@ MainWindow::MainWindow(int argc, char *argv[]) : app_(App::create())
 void MainWindow::login()
 {
     need_login_ = false;
-    auto port = std::atoi(global().get_port().data());
-    auto host = global().get_host().data();
+    auto name = cc_conf_.name;
+    auto host = cc_conf_.host;
+    auto port = cc_conf_.port;
+    if (app_) {
+        name = global().get_user().data();
+        host = global().get_host().data();
+        port = std::atoi(global().get_port().data());
+    }
 
-    cc_->set_name(global().get_user().data());
+    cc_->set_name(name);
     cc_->login(host, port);
+    pc_->prewarm_codecs(capture_opts.width, capture_opts.height);
 }
 
 void MainWindow::logout()
@@ -143,7 +254,13 @@ void MainWindow::post_chat(const std::string &msg)
     pc_->post_text_message(msg);
 }
 
-void MainWindow::stop() { slint::quit_event_loop(); }
+void MainWindow::stop()
+{
+    quit_ = true;
+    if (app_) {
+        slint::quit_event_loop();
+    }
+}
 
 void MainWindow::run()
 {
@@ -154,6 +271,9 @@ void MainWindow::run()
     };
 
     auto toggle_grab = [this] {
+        if (!screen_renderer_) {
+            return;
+        }
         auto window = screen_renderer_->get_window();
         auto state = SDL_GetWindowGrab(window);
         SDL_SetWindowGrab(window, state ? SDL_FALSE : SDL_TRUE);
@@ -185,12 +305,19 @@ void MainWindow::run()
         while (SDL_PollEvent(&e)) {
             handle_remote_event(e);
         }
+        refresh_focus();
 
-        global().set_online(cc_->online());
-
-        screen_renderer_->update_frame();
+        if (app_) {
+            global().set_online(cc_->online());
+        }
+        // frames are presented by the renderers' own threads
     };
 
+    if (headless_) {
+        run_headless(poll, update_stats);
+        return;
+    }
+
     Trigger::on({SDLK_LCTRL, SDLK_LSHIFT, SDLK_LALT, SDLK_q}, toggle_grab);
     slint::Timer stats_timer(std::chrono::seconds(5), update_stats);
     slint::Timer poll_timer(std::chrono::milliseconds(0), poll);
@@ -199,8 +326,51 @@ void MainWindow::run()
     slint::run_event_loop();
 }
 
+void MainWindow::run_headless(const std::function<void()> &poll,
+                              const std::function<void()> &update_stats)
+{
+    using namespace std::chrono_literals;
+    auto work = boost::asio::make_work_guard(ioctx_);
+    if (need_login_) {
+        login();
+    }
+
+    auto next_stats = std::chrono::steady_clock::now() + 5s;
+    while (!quit_) {
+        poll();
+        if (std::chrono::steady_clock::now() >= next_stats) {
+            update_stats();
+            next_stats += 5s;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+}
+
+void MainWindow::refresh_focus()
+{
+    if (!pc_conf_.encoder.roi || !pc_ || !ee_) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_focus_) {
+        return;
+    }
+    next_focus_ = now + std::chrono::microseconds(1000000) / capture_opts.fps;
+    // the focus moves without remote input too, e.g. a window opening, and
+    // a focus that isn't refreshed expires
+    if (auto a = ee_->focused_area()) {
+        InterestRegions::instance().set_focus(
+            {a->left, a->top, a->right, a->bottom});
+    }
+}
+
 void MainWindow::handle_remote_event(SDL_Event &e)
 {
+    // Ctrl-C, the only way to end a headless run
+    if (headless_ && e.type == SDL_QUIT) {
+        stop();
+        return;
+    }
     Trigger::processEvent(e);
     switch (e.type) {
     case SDL_WINDOWEVENT:
@@ -238,6 +408,19 @@ static PeerData to_peer_data(const Peer &p)
 
 void MainWindow::OnPeersChanged(Peer::List peers)
 {
+    if (!app_) {
+        // polled on this thread, see `run_headless`
+        auto name = absl::GetFlag(FLAGS_connect);
+        for (const auto &[id, p] : peers) {
+            if (!name.empty() && p.name == name && p.online &&
+                !cc_->calling()) {
+                logger::info("connect to {} ({})", p.name, id);
+                connect(id);
+                break;
+            }
+        }
+        return;
+    }
     slint::invoke_from_event_loop([this, peers = std::move(peers)] {
         auto model = std::make_shared<slint::VectorModel<PeerData>>();
         for (const auto &[id, p] : peers) {
@@ -249,12 +432,18 @@ void MainWindow::OnPeersChanged(Peer::List peers)
 
 void MainWindow::OnLogin(Peer me)
 {
+    if (!app_) {
+        return;
+    }
     slint::invoke_from_event_loop(
         [this, me] { global().set_online(me.online); });
 }
 
 void MainWindow::OnLogout(Peer me)
 {
+    if (!app_) {
+        return;
+    }
     slint::invoke_from_event_loop(
         [this, me] { global().set_online(me.online); });
 }
@@ -3,6 +3,7 @@
 #include "executor/event_executor.hh"
 #include "peer_client.hh"
 #include "signal_client.hh"
+#include "sink/null_sink.hh"
 #include "sink/video_renderer.hh"
 #include "source/camera_capturer.hh"
 #include "source/screen_capturer.hh"
@@ -10,7 +11,10 @@
 
 #include "ui/app.slint.h"
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <string>
 #include <thread>
 
@@ -24,6 +28,10 @@ class MainWindow : public UIObserver
     MainWindow(int argc, char *argv[]);
     ~MainWindow() = default;
 
+    // --null_sink, no UI and no windows, SDL needs no video subsystem
+    static bool headless();
+    // --use_h264, the custom codec factories are used
+    static bool custom_codecs();
     void run();
     void stop();
 
@@ -43,9 +51,14 @@ class MainWindow : public UIObserver
     void disconnect();
     void update_chat(const std::string &who, const char *buf);
     void post_chat(const std::string &msg);
+    // the focused window of the shared screen, once per captured frame
+    void refresh_focus();
+    // the Slint event loop needs a display, poll at the timers' pace instead
+    void run_headless(const std::function<void()> &poll,
+                      const std::function<void()> &update_stats);
 
     // misc
-    const ClientState &global() {return app_->global<ClientState>(); };
+    const ClientState &global() {return (*app_)->global<ClientState>(); };
 
   private:
     // properties
@@ -62,16 +75,21 @@ class MainWindow : public UIObserver
     rtc::scoped_refptr<ScreenCapturer> screen_video_src_ = nullptr;
     rtc::scoped_refptr<VideoRenderer> camera_renderer_ = nullptr;
     rtc::scoped_refptr<VideoRenderer> screen_renderer_ = nullptr;
+    // instead of `screen_renderer_` for benchmarks
+    rtc::scoped_refptr<NullSink> screen_null_sink_ = nullptr;
     rtc::scoped_refptr<StatsObserver> stats_observer_ = nullptr;
 
-    // slint ui
-    slint::ComponentHandle<App> app_;
+    // slint ui, none if headless
+    std::optional<slint::ComponentHandle<App>> app_;
 
     // states
     bool need_login_ = false;
     bool running_ = false;
+    bool headless_ = false;
+    std::atomic<bool> quit_ = false;
     std::vector<char> chatbuf_;
     bool chatbuf_updated_ = false;
     bool show_stats_ = false;
     std::string stats_json_;
+    std::chrono::steady_clock::time_point next_focus_;
 };
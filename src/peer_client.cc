@@ -1,7 +1,16 @@
 #include "peer_client.hh"
-
+#include "codec/decoder/factory.hh"
+#include "codec/dirty_rects.hh"
+#include "codec/encoder/capabilities.hh"
+#include "codec/encoder/factory.hh"
+#include "codec/encoder/regions.hh"
+
+#include <algorithm>
+#include <iterator>
 #include <utility>
 
+#include <SDL2/SDL_events.h>
+
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 #include "api/audio_codecs/builtin_audio_encoder_factory.h"
 #include "api/create_peerconnection_factory.h"
@@ -14,6 +23,7 @@
 
 static const std::string kAudioLabel = "x-remote-track-audio";
 static const std::string kDataChanId = "x-remote-chan-input";
+static const std::string kDirtyRectsChanId = "x-remote-chan-dirty-rects";
 static const std::string kCameraVideoLabel = "x-remote-track-camera";
 static const std::string kScreenVideoLabel = "x-remote-track-screen";
 static const int kStartBitrate = 100 * 1000 * 1000; // 100Mbps
@@ -23,6 +33,59 @@ static const int kMaxFPS = 60;
 
 using SignalingState = webrtc::PeerConnectionInterface::SignalingState;
 
+// carries `DirtyRects` updates, the sharer sends and the viewer receives
+struct DirtyRectsChannel : public webrtc::DataChannelObserver {
+    // an update waiting behind this much is too late to be useful
+    static constexpr uint64_t kMaxBufferedBytes =
+        64 * sizeof(DirtyRects::Update);
+
+    DirtyRectsChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> chan,
+                      bool sender)
+        : chan_(std::move(chan)), sender_(sender)
+    {
+        chan_->RegisterObserver(this);
+        // a remote channel is usually open already
+        OnStateChange();
+    }
+
+    ~DirtyRectsChannel() override
+    {
+        if (sender_) {
+            DirtyRects::instance().set_sender(nullptr);
+        }
+        chan_->UnregisterObserver();
+    }
+
+    void OnStateChange() override
+    {
+        if (!sender_) {
+            return;
+        }
+        if (chan_->state() != webrtc::DataChannelInterface::kOpen) {
+            DirtyRects::instance().set_sender(nullptr);
+            return;
+        }
+        DirtyRects::instance().set_sender(
+            [chan = chan_](const uint8_t *data, size_t size) {
+                if (chan->buffered_amount() > kMaxBufferedBytes) {
+                    return false;
+                }
+                rtc::CopyOnWriteBuffer buf(data, size);
+                return chan->Send(webrtc::DataBuffer{buf, true});
+            });
+    }
+
+    void OnMessage(const webrtc::DataBuffer &msg) override
+    {
+        if (msg.binary) {
+            DirtyRects::instance().receive(msg.data.data(), msg.size());
+        }
+    }
+
+    rtc::scoped_refptr<webrtc::DataChannelInterface> chan_;
+    bool sender_;
+};
+
 static void
 set_encoding_params(rtc::scoped_refptr<webrtc::RtpSenderInterface> &&sender)
 {
@@ -50,6 +113,34 @@ set_encoding_params(rtc::scoped_refptr<webrtc::RtpSenderInterface> &&sender)
     sender->SetParameters(params);
 }
 
+// every profile of `mime_type` in the encoder factory's order, e.g. H264 High
+// 4:4:4 falls back to the 4:2:0 profiles. Conservative until the custom
+// encoders are probed, see `EncoderCapabilities::Get`.
+static std::vector<webrtc::RtpCodecCapability>
+prefered_codecs(webrtc::PeerConnectionFactoryInterface *factory,
+                const std::string &mime_type)
+{
+    auto capabilities =
+        factory->GetRtpSenderCapabilities(cricket::MEDIA_TYPE_VIDEO);
+    auto &codecs = capabilities.codecs;
+    std::vector<std::pair<std::string, std::string>> codec_names;
+    for (auto &codec : codecs) {
+        codec_names.emplace_back(codec.mime_type(), codec.name);
+    }
+    logger::debug("supported codecs: {}", codec_names);
+
+    std::vector<webrtc::RtpCodecCapability> result;
+    std::copy_if(codecs.cbegin(), codecs.cend(), std::back_inserter(result),
+                 [&mime_type](const auto &it) {
+                     return it.mime_type() == mime_type;
+                 });
+    if (!result.empty()) {
+        logger::debug("prefered codecs: {} ({} formats)", mime_type,
+                      result.size());
+    }
+    return result;
+}
+
 struct SetLocalSDPCallback
     : public webrtc::SetLocalDescriptionObserverInterface {
     static rtc::scoped_refptr<SetLocalSDPCallback> Create(PeerClient *that)
@@ -109,40 +200,29 @@ PeerClient::PeerClient(Config conf) : conf_(std::move(conf))
     signaling_thread_ = rtc::Thread::CreateWithSocketServer();
     signaling_thread_->Start();
 
+    std::unique_ptr<webrtc::VideoEncoderFactory> encoder_factory;
+    std::unique_ptr<webrtc::VideoDecoderFactory> decoder_factory;
+    if (conf_.use_codec) {
+        encoder_factory =
+            std::make_unique<CustomVideoEncoderFactory>(conf_.encoder);
+        decoder_factory =
+            std::make_unique<CustomVideoDecoderFactory>(conf_.decoder);
+    } else {
+        encoder_factory = webrtc::CreateBuiltinVideoEncoderFactory();
+        decoder_factory = webrtc::CreateBuiltinVideoDecoderFactory();
+    }
+
     pc_factory_ = webrtc::CreatePeerConnectionFactory(
         nullptr, nullptr, signaling_thread_.get(), nullptr,
         webrtc::CreateBuiltinAudioEncoderFactory(),
         webrtc::CreateBuiltinAudioDecoderFactory(),
-        webrtc::CreateBuiltinVideoEncoderFactory(),
-        webrtc::CreateBuiltinVideoDecoderFactory(),
-        /* std::make_unique<CustomVideoEncoderFactory>(), // */
-        /* std::make_unique<CustomVideoDecoderFactory>(), // */
-        nullptr, nullptr);
+        std::move(encoder_factory), std::move(decoder_factory), nullptr,
+        nullptr);
 
     webrtc::PeerConnectionFactoryInterface::Options factory_opts;
     // disable_encryption would make data_channel create failed, bug?
     /* factory_opts.disable_encryption = true; */
     pc_factory_->SetOptions(factory_opts);
-
-    {
-        auto capabilities =
-            pc_factory_->GetRtpSenderCapabilities(cricket::MEDIA_TYPE_VIDEO);
-        auto &codecs = capabilities.codecs;
-        std::vector<std::pair<std::string, std::string>> codec_names{
-            capabilities.codecs.size()};
-        for (auto &codec : codecs) {
-            codec_names.emplace_back(codec.mime_type(), codec.name);
-        }
-        logger::debug("supported codecs: {}", codec_names);
-        auto findfn = [this](const auto &it) {
-            return it.mime_type() == conf_.video_codec;
-        };
-        auto cap = std::find_if(codecs.cbegin(), codecs.cend(), findfn);
-        if (cap != codecs.cend()) {
-            logger::debug("prefered codecs: {}", conf_.video_codec);
-            prefered_codecs_.emplace_back(*cap);
-        }
-    }
 }
 
 PeerClient::~PeerClient()
@@ -188,6 +268,8 @@ bool PeerClient::create_peer_connection()
 
 void PeerClient::delete_peer_connection()
 {
+    dirty_rects_chan_ = nullptr;
+    DirtyRects::instance().clear();
     pc_->Close();
     pc_ = nullptr;
     mq_ = std::make_unique<MessageQueue>();
@@ -195,6 +277,11 @@ void PeerClient::delete_peer_connection()
 
     if (camera_src_ && camera_src_->state() == VideoTrackSource::kLive)
         camera_src_->Stop();
+    for (auto &tile : tile_srcs_) {
+        tile->Stop();
+    }
+    tile_srcs_.clear();
+    tile_sinks_.clear();
     if (screen_src_ && screen_src_->state() == VideoTrackSource::kLive)
         screen_src_->Stop();
     if (camera_sink_)
@@ -220,7 +307,8 @@ void PeerClient::create_transceivers()
         }
     }
 
-    if (conf_.enable_screen) {
+    // one per tile track
+    for (int i = 0; conf_.enable_screen && i < tile_count(); i++) {
         auto trans =
             pc_->AddTransceiver(cricket::MediaType::MEDIA_TYPE_VIDEO, init);
         if (!trans.ok()) {
@@ -260,7 +348,23 @@ void PeerClient::create_media_tracks()
         }
     }
 
-    if (conf_.enable_screen && screen_src_) {
+    if (conf_.enable_screen && screen_src_ && tile_count() > 1) {
+        screen_src_->Start();
+        auto converter = std::make_shared<TileSource::Converter>();
+        for (int i = 0; i < tile_count(); i++) {
+            TileSource::Config tc{i, conf_.tile_columns, conf_.tile_rows};
+            auto tile = TileSource::Create(screen_src_, tc, converter);
+            tile->Start();
+            auto label = TileSource::Label(kScreenVideoLabel, tc);
+            auto track = pc_factory_->CreateVideoTrack(label, tile.get());
+            auto result = pc_->AddTrack(track, {label});
+            if (!result.ok()) {
+                logger::error("failed to add screen tile track {}", label);
+                continue;
+            }
+            tile_srcs_.push_back(std::move(tile));
+        }
+    } else if (conf_.enable_screen && screen_src_) {
         screen_src_->Start();
         // the scoped_refptr version will throw a weird `bad_alloc`, bug?
         auto track =
@@ -273,6 +377,11 @@ void PeerClient::create_media_tracks()
         }
     }
 
+    if (conf_.use_codec) {
+        // again for every session, the probe may have finished since
+        prefered_codecs_ =
+            prefered_codecs(pc_factory_.get(), conf_.video_codec);
+    }
     if (conf_.use_codec && !prefered_codecs_.empty()) {
         auto ts = pc_->GetTransceivers();
         for (const auto &t : ts) {
@@ -298,6 +407,22 @@ void PeerClient::create_data_channel()
     } else {
         logger::error("failed to add data channel");
     }
+
+    if (!conf_.dirty_rects) {
+        return;
+    }
+    // a late or lost update only costs a full upload, never wait for it
+    webrtc::DataChannelInit dirty_config;
+    dirty_config.ordered = false;
+    dirty_config.maxRetransmits = 0;
+    auto dirty_chan =
+        pc_->CreateDataChannelOrError(kDirtyRectsChanId, &dirty_config);
+    if (dirty_chan.ok()) {
+        dirty_rects_chan_ =
+            std::make_unique<DirtyRectsChannel>(dirty_chan.MoveValue(), false);
+    } else {
+        logger::error("failed to add dirty rects channel");
+    }
 }
 
 void PeerClient::add_camera_video_source(VideoSourcePtr src)
@@ -438,10 +563,17 @@ void PeerClient::OnTrack(
         auto video_track = static_cast<webrtc::VideoTrackInterface *>(track);
         // `track->id` is not guaranteed to be the same as `label` in remote
         // pc_factory_->CreateVideoTrack(`label`), use stream id instead
-        if (transceiver->receiver()->stream_ids()[0] == kScreenVideoLabel &&
-            screen_sink_) {
+        auto stream_id = transceiver->receiver()->stream_ids()[0];
+        TileSource::Config tc;
+        if (stream_id == kScreenVideoLabel && screen_sink_) {
             video_track->AddOrUpdateSink(screen_sink_.get(),
                                          rtc::VideoSinkWants());
+        } else if (TileSource::ParseLabel(kScreenVideoLabel, stream_id, tc) &&
+                   screen_sink_) {
+            auto &sink = tile_sinks_[stream_id];
+            sink = std::make_unique<TileSink>(screen_sink_.get(), tc.index,
+                                              tc.columns, tc.rows);
+            video_track->AddOrUpdateSink(sink.get(), rtc::VideoSinkWants());
         }
         if (transceiver->receiver()->stream_ids()[0] == kCameraVideoLabel &&
             camera_sink_) {
@@ -465,6 +597,11 @@ void PeerClient::OnRemoveTrack(
         if (receiver->stream_ids()[0] == kScreenVideoLabel && screen_sink_) {
             video_track->RemoveSink(screen_sink_.get());
         }
+        auto tile = tile_sinks_.find(receiver->stream_ids()[0]);
+        if (tile != tile_sinks_.end()) {
+            video_track->RemoveSink(tile->second.get());
+            tile_sinks_.erase(tile);
+        }
         if (receiver->stream_ids()[0] == kCameraVideoLabel && camera_sink_) {
             video_track->RemoveSink(camera_sink_.get());
         }
@@ -476,6 +613,11 @@ void PeerClient::OnDataChannel(
 {
     logger::debug("new remote channel [id={} proto={}] connected",
                   data_channel->id(), data_channel->protocol());
+    if (data_channel->label() == kDirtyRectsChanId) {
+        dirty_rects_chan_ =
+            std::make_unique<DirtyRectsChannel>(data_channel, true);
+        return;
+    }
     data_chan_ = data_channel;
     data_chan_->RegisterObserver(this);
 }
@@ -517,6 +659,15 @@ void PeerClient::OnMessage(const webrtc::DataBuffer &msg)
         std::string m(reinterpret_cast<const char *>(msg.data.data()),
                       msg.size());
         // logger::debug("recv remote text message: {}", m);
+    } else if (conf_.input_width > 0 && conf_.input_height > 0 &&
+               msg.size() >= sizeof(SDL_MouseMotionEvent)) {
+        // the viewer looks where its pointer is
+        auto *e = reinterpret_cast<const SDL_Event *>(msg.data.data());
+        if (e->type == SDL_MOUSEMOTION) {
+            InterestRegions::instance().set_pointer(
+                double(e->motion.x) / conf_.input_width,
+                double(e->motion.y) / conf_.input_height);
+        }
     }
     mq_->push(PeerClient::ChanMessage{msg.data.data(), msg.size(), msg.binary});
 }
@@ -550,3 +701,34 @@ std::optional<PeerClient::ChanMessage> PeerClient::poll_remote_message()
 }
 
 void PeerClient::get_stats() { pc_->GetStats(stats_observer_); }
+
+void PeerClient::prewarm_codecs(int width, int height)
+{
+    if (!conf_.use_codec) {
+        return;
+    }
+    if (!prewarm_thread_) {
+        prewarm_thread_ = rtc::Thread::Create();
+        prewarm_thread_->SetName("codec_prewarm", nullptr);
+        prewarm_thread_->Start();
+    }
+
+    // every tile track has its own encoder
+    width = (width / conf_.tile_columns) & ~1;
+    height = (height / conf_.tile_rows) & ~1;
+    prewarm_thread_->PostTask([conf = conf_, factory = pc_factory_, width,
+                               height] {
+        // warm the backend the sessions will use, not the defaults
+        EncoderCapabilities::Wait();
+        // the format `SetCodecPreferences` puts first, e.g. High 4:4:4 if
+        // --i444 and the backends can sustain it
+        auto codecs = prefered_codecs(factory.get(), conf.video_codec);
+        if (codecs.empty()) {
+            return;
+        }
+        webrtc::SdpVideoFormat format(codecs.front().name,
+                                      codecs.front().parameters);
+        CustomVideoEncoderFactory(conf.encoder).Prewarm(format, width, height);
+        CustomVideoDecoderFactory(conf.decoder).Prewarm(format.name);
+    });
+}
@@ -1,14 +1,20 @@
 #pragma once
 
 #include "callbacks.hh"
+#include "codec/decoder/h264_ffmpeg.hh"
+#include "codec/encoder/h264_vaapi.hh"
 #include "sink/video_sink.hh"
+#include "source/tile_source.hh"
 #include "source/video_source.hh"
 #include "stats/stats.hh"
 
+#include <map>
 #include <memory>
 
 #include "api/peer_connection_interface.h"
 
+struct DirtyRectsChannel;
+
 struct PeerClient : private webrtc::PeerConnectionObserver,
                     private webrtc::DataChannelObserver,
                     public PeerObserver {
@@ -26,6 +32,18 @@ struct PeerClient : private webrtc::PeerConnectionObserver,
         bool enable_clipboard = false;
         bool enable_file_transfer = false;
         std::vector<std::string> stun_servers = {};
+        FFMPEGEncoder::Config encoder = {};
+        FFMPEGDecoder::Config decoder = {};
+        // viewer window size of the remote input events
+        int input_width = 0;
+        int input_height = 0;
+        // the screen is sent as a grid of tile tracks if more than one cell,
+        // must be the same on both sides
+        int tile_columns = 1;
+        int tile_rows = 1;
+        // the viewer asks for the changed area of each screen frame, so it
+        // uploads only that, see `DirtyRects`
+        bool dirty_rects = false;
     };
 
     struct ChanMessage {
@@ -63,8 +81,12 @@ struct PeerClient : private webrtc::PeerConnectionObserver,
     std::optional<ChanMessage> poll_remote_message();
     // stats
     void get_stats();
+    // open the custom codecs in the background, later sessions take the
+    // warm contexts instead of opening their own
+    void prewarm_codecs(int width, int height);
 
   private:
+    int tile_count() const { return conf_.tile_columns * conf_.tile_rows; }
     // internal resources about
     bool create_peer_connection();
     void delete_peer_connection();
@@ -112,16 +134,20 @@ struct PeerClient : private webrtc::PeerConnectionObserver,
     VideoSourcePtr screen_src_ = nullptr;
     VideoSinkPtr camera_sink_ = nullptr;
     VideoSinkPtr screen_sink_ = nullptr;
+    std::vector<rtc::scoped_refptr<TileSource>> tile_srcs_;
+    std::map<std::string, std::unique_ptr<TileSink>> tile_sinks_;
     SignalingObserver *signaling_observer_ = nullptr;
     StatsObserver *stats_observer_ = nullptr;
     // internal resources
     // must before `pc_factory_`, due to destruction order
     std::unique_ptr<rtc::Thread> signaling_thread_ = nullptr;
+    std::unique_ptr<rtc::Thread> prewarm_thread_ = nullptr;
     rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory_ =
         nullptr;
     // TODO: multiple pc instances support?
     rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_ = nullptr;
     rtc::scoped_refptr<webrtc::DataChannelInterface> data_chan_ = nullptr;
+    std::unique_ptr<DirtyRectsChannel> dirty_rects_chan_;
     std::unique_ptr<MessageQueue> mq_;
 
     // states
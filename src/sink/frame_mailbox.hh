@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "absl/types/optional.h"
+#include "api/video/video_frame.h"
+
+// Single slot of the newest frame between a producer and the render loop,
+// lock free. A frame that wasn't taken before the next one arrives is
+// replaced, so the renderer always shows the latest frame and holds at most
+// one pending buffer.
+class FrameMailbox
+{
+  public:
+    ~FrameMailbox() { take(); }
+
+    // true if an untaken frame was overwritten
+    bool put(const webrtc::VideoFrame &frame)
+    {
+        std::unique_ptr<webrtc::VideoFrame> old(slot_.exchange(
+            new webrtc::VideoFrame(frame), std::memory_order_acq_rel));
+        if (!old) {
+            return false;
+        }
+        overwritten_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // nothing if no frame arrived since the last call
+    absl::optional<webrtc::VideoFrame> take()
+    {
+        std::unique_ptr<webrtc::VideoFrame> frame(
+            slot_.exchange(nullptr, std::memory_order_acq_rel));
+        if (!frame) {
+            return absl::nullopt;
+        }
+        return std::move(*frame);
+    }
+
+    // a frame is waiting, it may be taken right after
+    bool pending() const
+    {
+        return slot_.load(std::memory_order_acquire) != nullptr;
+    }
+
+    uint64_t overwritten() const
+    {
+        return overwritten_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<webrtc::VideoFrame *> slot_ = nullptr;
+    std::atomic<uint64_t> overwritten_ = 0;
+};
@@ -0,0 +1,392 @@
+#include "null_sink.hh"
+#include "logger.hh"
+#include "stats/render_stats.hh"
+
+#include <cstring>
+#include <vector>
+
+#include <libyuv/compare.h>
+
+#ifdef __linux__
+#include "yuv_quad.hh"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#endif
+
+#include "rtc_base/time_utils.h"
+
+// djb2 of the visible rows, strides differ between decoders
+static uint32_t hash_planes(const webrtc::PlanarYuv8Buffer &yuv,
+                            uint32_t seed)
+{
+    auto hash_plane = [&seed](const uint8_t *data, int stride, int width,
+                              int height) {
+        for (int y = 0; y < height; y++) {
+            seed = libyuv::HashDjb2(data + y * stride, width, seed);
+        }
+    };
+    hash_plane(yuv.DataY(), yuv.StrideY(), yuv.width(), yuv.height());
+    hash_plane(yuv.DataU(), yuv.StrideU(), yuv.ChromaWidth(),
+               yuv.ChromaHeight());
+    hash_plane(yuv.DataV(), yuv.StrideV(), yuv.ChromaWidth(),
+               yuv.ChromaHeight());
+    return seed;
+}
+
+#ifdef __linux__
+// a space separated extension list contains `name`
+static bool has_extension(const char *extensions, const char *name)
+{
+    if (!extensions) {
+        return false;
+    }
+    auto len = std::strlen(name);
+    for (auto *p = extensions; (p = std::strstr(p, name)); p += len) {
+        if ((p == extensions || p[-1] == ' ') &&
+            (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// An OpenGL context without a window, current only while drawing so it can
+// be destroyed from another thread
+class NullSink::Offscreen
+{
+  public:
+    struct Upload {
+        int64_t us = 0;
+        int64_t bytes = 0;
+    };
+
+  public:
+    ~Offscreen();
+    static std::unique_ptr<Offscreen> Create();
+
+    // into a framebuffer of the frame size, done when it returns
+    Upload draw(const webrtc::PlanarYuv8Buffer &yuv, bool readback);
+
+  private:
+    bool init();
+    void allocate(int width, int height, int cw, int ch);
+    void release_targets();
+
+  private:
+    // resources
+    EGLDisplay display_ = EGL_NO_DISPLAY;
+    EGLContext context_ = EGL_NO_CONTEXT;
+    EGLSurface surface_ = EGL_NO_SURFACE;
+    std::unique_ptr<YuvQuad> quad_;
+    GLuint textures_[3] = {0, 0, 0};
+    GLuint fbo_ = 0;
+    GLuint rbo_ = 0;
+    std::vector<uint8_t> pixels_;
+    // states
+    int sizes_[3][2] = {};
+};
+
+std::unique_ptr<NullSink::Offscreen> NullSink::Offscreen::Create()
+{
+    std::unique_ptr<Offscreen> offscreen(new Offscreen);
+    if (!offscreen->init()) {
+        return nullptr;
+    }
+    return offscreen;
+}
+
+bool NullSink::Offscreen::init()
+{
+    // no window system at all if Mesa can, else the default display
+    auto *client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    bool surfaceless_platform =
+        has_extension(client, "EGL_MESA_platform_surfaceless");
+    if (surfaceless_platform) {
+        auto get_platform_display =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+                eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (get_platform_display) {
+            display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                            EGL_DEFAULT_DISPLAY, nullptr);
+        }
+    }
+    if (display_ == EGL_NO_DISPLAY) {
+        display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (display_ == EGL_NO_DISPLAY ||
+        !eglInitialize(display_, &major, &minor)) {
+        logger::error("no EGL display for offscreen rendering");
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        logger::error("EGL has no desktop OpenGL");
+        return false;
+    }
+
+    bool surfaceless = has_extension(eglQueryString(display_, EGL_EXTENSIONS),
+                                     "EGL_KHR_surfaceless_context");
+    const EGLint config_attrs[] = {
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT, //
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,                 //
+        EGL_RED_SIZE, 8,                                     //
+        EGL_GREEN_SIZE, 8,                                   //
+        EGL_BLUE_SIZE, 8,                                    //
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(display_, config_attrs, &config, 1, &count) ||
+        count < 1) {
+        logger::error("no EGL config for offscreen rendering");
+        return false;
+    }
+
+    // the same version the windowed renderer asks for
+    const EGLint context_attrs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,                              //
+        EGL_CONTEXT_MINOR_VERSION, 3,                              //
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,                           //
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,                       //
+        EGL_NONE,
+    };
+    context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT,
+                                context_attrs);
+    if (context_ == EGL_NO_CONTEXT) {
+        logger::error("failed to create offscreen context: {:#x}",
+                      eglGetError());
+        return false;
+    }
+    // everything is drawn into a framebuffer object, a surface is only made
+    // if the context can't be current without one
+    if (!surfaceless) {
+        const EGLint pbuffer_attrs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16,
+                                        EGL_NONE};
+        surface_ = eglCreatePbufferSurface(display_, config, pbuffer_attrs);
+    }
+    if (!eglMakeCurrent(display_, surface_, surface_, context_)) {
+        logger::error("failed to make offscreen context current: {:#x}",
+                      eglGetError());
+        return false;
+    }
+
+    // glewInit also wants a GLX display, only the GL entry points are needed
+    glewExperimental = GL_TRUE;
+    if (glewContextInit() != GLEW_OK) {
+        logger::error("glew init failed for offscreen context");
+        eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+        return false;
+    }
+    quad_ = std::make_unique<YuvQuad>();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    logger::info("offscreen rendering on EGL {}.{}, {} ({})", major, minor,
+                 reinterpret_cast<const char *>(glGetString(GL_RENDERER)),
+                 surfaceless ? "surfaceless" : "pbuffer");
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return true;
+}
+
+NullSink::Offscreen::~Offscreen()
+{
+    if (context_ != EGL_NO_CONTEXT &&
+        eglMakeCurrent(display_, surface_, surface_, context_)) {
+        release_targets();
+        quad_ = nullptr;
+        eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+    }
+    if (surface_ != EGL_NO_SURFACE) {
+        eglDestroySurface(display_, surface_);
+    }
+    if (context_ != EGL_NO_CONTEXT) {
+        eglDestroyContext(display_, context_);
+    }
+    // the display is process wide and may be shared, it isn't terminated
+}
+
+void NullSink::Offscreen::allocate(int width, int height, int cw, int ch)
+{
+    const int sizes[3][2] = {{width, height}, {cw, ch}, {cw, ch}};
+    if (fbo_ && std::memcmp(sizes, sizes_, sizeof(sizes)) == 0) {
+        return;
+    }
+    release_targets();
+    std::memcpy(sizes_, sizes, sizeof(sizes));
+
+    for (int i = 0; i < 3; i++) {
+        textures_[i] = YuvQuad::create_texture();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, sizes[i][0], sizes[i][1], 0,
+                     GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    glGenRenderbuffers(1, &rbo_);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &fbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, rbo_);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        logger::error("incomplete offscreen framebuffer {}x{}", width, height);
+    }
+}
+
+void NullSink::Offscreen::release_targets()
+{
+    for (auto &tex : textures_) {
+        if (tex) {
+            glDeleteTextures(1, &tex);
+            tex = 0;
+        }
+    }
+    if (fbo_) {
+        glDeleteFramebuffers(1, &fbo_);
+        fbo_ = 0;
+    }
+    if (rbo_) {
+        glDeleteRenderbuffers(1, &rbo_);
+        rbo_ = 0;
+    }
+}
+
+NullSink::Offscreen::Upload
+NullSink::Offscreen::draw(const webrtc::PlanarYuv8Buffer &yuv, bool readback)
+{
+    Upload upload;
+    if (!eglMakeCurrent(display_, surface_, surface_, context_)) {
+        return upload;
+    }
+    allocate(yuv.width(), yuv.height(), yuv.ChromaWidth(),
+             yuv.ChromaHeight());
+
+    auto start_us = rtc::TimeMicros();
+    const uint8_t *planes[3] = {yuv.DataY(), yuv.DataU(), yuv.DataV()};
+    const int strides[3] = {yuv.StrideY(), yuv.StrideU(), yuv.StrideV()};
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures_[i]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, strides[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sizes_[i][0], sizes_[i][1],
+                        GL_RED, GL_UNSIGNED_BYTE, planes[i]);
+        upload.bytes += sizes_[i][0] * sizes_[i][1];
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    upload.us = rtc::TimeMicros() - start_us;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    glViewport(0, 0, yuv.width(), yuv.height());
+    quad_->draw();
+    // a window would wait here for the swap
+    if (readback) {
+        pixels_.resize(static_cast<size_t>(yuv.width()) * yuv.height() * 4);
+        glReadPixels(0, 0, yuv.width(), yuv.height(), GL_RGBA,
+                     GL_UNSIGNED_BYTE, pixels_.data());
+    } else {
+        glFinish();
+    }
+
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return upload;
+}
+#else
+class NullSink::Offscreen
+{
+  public:
+    struct Upload {
+        int64_t us = 0;
+        int64_t bytes = 0;
+    };
+
+  public:
+    static std::unique_ptr<Offscreen> Create()
+    {
+        logger::warn("offscreen rendering needs EGL, linux only");
+        return nullptr;
+    }
+
+    Upload draw(const webrtc::PlanarYuv8Buffer &yuv, bool readback)
+    {
+        return {};
+    }
+};
+#endif
+
+rtc::scoped_refptr<NullSink> NullSink::Create(Config conf)
+{
+    return rtc::make_ref_counted<NullSink>(conf);
+}
+
+NullSink::NullSink(Config conf) : conf_(conf)
+{
+    // offscreen drawing is what a readback reads
+    conf_.offscreen |= conf_.readback;
+    logger::debug("null sink created, checksum: {}, offscreen: {}, "
+                  "readback: {}",
+                  conf_.checksum, conf_.offscreen, conf_.readback);
+}
+
+NullSink::~NullSink()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    offscreen_ = nullptr;
+}
+
+void NullSink::Start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_ = 0;
+    checksum_ = 5381; // djb2
+    last_arrival_us_ = 0;
+    running_ = true;
+}
+
+void NullSink::Stop()
+{
+    running_ = false;
+    logger::info("null sink stopped after {} frames, checksum: {:08x}",
+                 frames_.load(), checksum_.load());
+}
+
+void NullSink::OnFrame(const webrtc::VideoFrame &frame)
+{
+    if (!running_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now_us = rtc::TimeMicros();
+    frames_++;
+
+    auto buffer = frame.video_frame_buffer();
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420;
+    const webrtc::PlanarYuv8Buffer *yuv = nullptr;
+    if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI444) {
+        yuv = buffer->GetI444();
+    } else if ((i420 = buffer->ToI420())) {
+        yuv = i420.get();
+    }
+
+    Offscreen::Upload upload;
+    if (yuv && conf_.checksum) {
+        checksum_ = hash_planes(*yuv, checksum_);
+    }
+    if (yuv && conf_.offscreen) {
+        if (!offscreen_ && !(offscreen_ = Offscreen::Create())) {
+            logger::warn("offscreen rendering disabled");
+            conf_.offscreen = false;
+        }
+        if (offscreen_) {
+            upload = offscreen_->draw(*yuv, conf_.readback);
+        }
+    }
+
+    if (conf_.stats && last_arrival_us_ > 0) {
+        RenderStats::instance().add(
+            {now_us, now_us - last_arrival_us_, upload.us, upload.bytes});
+    }
+    last_arrival_us_ = now_us;
+}
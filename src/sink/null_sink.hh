@@ -0,0 +1,58 @@
+#pragma once
+#include "video_sink.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Counts and drops frames without a window, for benchmarks on machines
+// without a display. Arrival intervals and their jitter go to `RenderStats`.
+// Frames can be checksummed, and drawn by an offscreen OpenGL context (EGL
+// surfaceless or pbuffer, e.g. Mesa llvmpipe) with an optional readback.
+// All of it runs on the thread delivering the frames, so a slow sink holds
+// back the receive path like a slow renderer would.
+struct NullSink : public VideoSink {
+  public:
+    struct Config {
+        // fold the planes of every frame into `checksum()`
+        bool checksum = false;
+        // upload and draw every frame offscreen, linux only
+        bool offscreen = false;
+        // read the drawn frame back instead of just waiting for the GPU
+        bool readback = false;
+        // record arrivals in `RenderStats`
+        bool stats = true;
+    };
+
+  public:
+    static rtc::scoped_refptr<NullSink> Create(Config conf);
+    explicit NullSink(Config conf);
+    ~NullSink() override;
+
+    uint64_t frames() const { return frames_; }
+    // of the decoded planes, the same on every GPU
+    uint32_t checksum() const { return checksum_; }
+
+    // impl VideoSinkInterface
+    void OnFrame(const webrtc::VideoFrame &frame) override;
+    // impl VideoSink
+    void Start() override;
+    void Stop() override;
+
+  private:
+    class Offscreen;
+
+  private:
+    // properties
+    Config conf_;
+    // resources
+    std::mutex mutex_;
+    // created on the delivering thread by the first frame
+    std::unique_ptr<Offscreen> offscreen_;
+    // states
+    std::atomic<bool> running_ = false;
+    std::atomic<uint64_t> frames_ = 0;
+    std::atomic<uint32_t> checksum_ = 0;
+    int64_t last_arrival_us_ = 0;
+};
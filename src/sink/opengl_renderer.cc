@@ -1,8 +1,11 @@
 #include "opengl_renderer.hh"
 #include "logger.hh"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
+#include <vector>
 
 #include <GL/glew.h>
 #include <SDL2/SDL_opengl.h>
@@ -11,52 +14,9 @@
 #include <SDL2/SDL_version.h>
 #include <SDL2/SDL_video.h>
 
-static const std::string vs_src = R"(
-    #version 330 core
-
-    layout (location = 0) in vec2 aPosition;
-    layout (location = 1) in vec2 aTexCoord;
-
-    varying vec2 vTexCoord;
-
-    void main() {
-      gl_Position = vec4(aPosition, 0.0, 1.0);
-      vTexCoord = aTexCoord;
-    }
-)";
-static const std::string fs_src = R"(
-    #version 330 core
-
-    varying vec2 vTexCoord;
-
-    uniform sampler2D uTexY;
-    uniform sampler2D uTexU;
-    uniform sampler2D uTexV;
-
-    void main() {
-      vec3 yuv;
-      vec3 rgb;
-      yuv.x = texture2D(uTexY, vTexCoord).r;
-      yuv.y = texture2D(uTexU, vTexCoord).r - 0.5;
-      yuv.z = texture2D(uTexV, vTexCoord).r - 0.5;
-      rgb = mat3( 1,       1,         1,
-                  0,       -0.39465,  2.03211,
-                  1.13983, -0.58060,  0) * yuv;
-      gl_FragColor = vec4(rgb, 1);
-    }
-)";
-static const float vertices[] = {
-    // position|texcoord
-    -1.0, -1.0, 0.0, 1.0, // lt
-    +1.0, -1.0, 1.0, 1.0, // rt
-    -1.0, +1.0, 0.0, 0.0, // lb
-    +1.0, +1.0, 1.0, 0.0, // rb
-};
-
-static const int indices[] = {
-    0, 1, 2, //
-    1, 2, 3, //
-};
+#include <libyuv/planar_functions.h>
+
+#include "rtc_base/time_utils.h"
 
 OpenGLRenderer::OpenGLRenderer(Config conf) : VideoRenderer(std::move(conf))
 {
@@ -65,144 +25,244 @@ OpenGLRenderer::OpenGLRenderer(Config conf) : VideoRenderer(std::move(conf))
         throw std::runtime_error("glew init failed");
     }
     assert(glctx_);
+    // adaptive vsync isn't supported everywhere
+    if (SDL_GL_SetSwapInterval(conf_.swap_interval) < 0 &&
+        conf_.swap_interval < 0) {
+        logger::warn("adaptive vsync unsupported, fallback to vsync");
+        SDL_GL_SetSwapInterval(1);
+    }
 
     glViewport(0, 0, conf_.width, conf_.height);
 
-    program_ = create_program(vs_src, fs_src);
-    glUseProgram(program_);
-
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-
-    glBindVertexArray(vao);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
-                 GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, false, 4 * sizeof(float), nullptr);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 2, GL_FLOAT, false, 4 * sizeof(float), (void *)8);
-    glEnableVertexAttribArray(1);
-
-    glBindVertexArray(0);
-
-    textures_[Y] = create_texture();
-    textures_[U] = create_texture();
-    textures_[V] = create_texture();
+    quad_ = std::make_unique<YuvQuad>();
+    // chroma rows of odd widths aren't 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glClearColor(0, 0, 0, 1);
+    if (!GLEW_ARB_buffer_storage) {
+        logger::warn("no persistent buffer mapping, upload synchronously");
+    }
 
-    glBindVertexArray(vao);
-    glUseProgram(program_);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
+    // textures are allocated at the size of the first frame
+    glClear(GL_COLOR_BUFFER_BIT);
     SDL_GL_SwapWindow(window_);
+
+    // a context is current on one thread only, `upload` takes it
+    if (conf_.render_thread) {
+        SDL_GL_MakeCurrent(window_, nullptr);
+    }
 }
 
 OpenGLRenderer::~OpenGLRenderer()
 {
+    // released by the render thread, see `on_render_thread_exit`
+    stop_render_thread();
+    SDL_GL_MakeCurrent(window_, glctx_);
 
-    glDeleteTextures(1, &textures_[V]);
-    glDeleteTextures(1, &textures_[U]);
-    glDeleteTextures(1, &textures_[Y]);
-
-    glDeleteBuffers(1, &ebo);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
+    release_buffers();
+    release_textures();
+    quad_ = nullptr;
 
-    glDeleteProgram(program_);
     SDL_GL_DeleteContext(glctx_);
 }
 
-GLuint OpenGLRenderer::create_texture()
+void OpenGLRenderer::on_render_thread_exit()
 {
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    return tex;
+    // GLX fails to make a context current that is still current on another
+    // thread, even a finished one
+    SDL_GL_MakeCurrent(window_, nullptr);
 }
 
-GLuint OpenGLRenderer::create_shader(unsigned typ, const std::string &code)
+bool OpenGLRenderer::allocate(int width, int height, int cw, int ch)
 {
-    const char *src = code.c_str();
-    GLuint shader = glCreateShader(typ);
-    glShaderSource(shader, 1, &src, nullptr);
-    glCompileShader(shader);
+    const int sizes[3][2] = {{width, height}, {cw, ch}, {cw, ch}};
+    if (textures_[Y] && std::memcmp(sizes, sizes_, sizeof(sizes)) == 0) {
+        return false;
+    }
+    release_textures();
+    std::memcpy(sizes_, sizes, sizeof(sizes));
+
+    // immutable storage can't be resized, new textures per resolution
+    std::vector<uint8_t> black;
+    for (int i : {Y, U, V}) {
+        textures_[i] = YuvQuad::create_texture();
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, sizes[i][0], sizes[i][1]);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, sizes[i][0], sizes[i][1], 0,
+                         GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        }
+        // tile cells may stay empty for a few frames
+        black.assign(sizes[i][0] * sizes[i][1], i == Y ? 0 : 128);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sizes[i][0], sizes[i][1],
+                        GL_RED, GL_UNSIGNED_BYTE, black.data());
+    }
+    logger::debug("allocated {}x{} textures, chroma {}x{}", width, height, cw,
+                  ch);
+    return true;
+}
 
-    int status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+void OpenGLRenderer::reserve(size_t size)
+{
+    if (!GLEW_ARB_buffer_storage || size <= buffer_size_) {
+        return;
+    }
+    release_buffers();
+    buffer_size_ = size;
+
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (auto &slot : slots_) {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        slot.data = static_cast<uint8_t *>(
+            glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    logger::debug("allocated {} upload buffers of {} bytes", kUploadSlots,
+                  size);
+}
 
-    if (!status) {
-        char logbuf[512] = {0};
-        glGetShaderInfoLog(shader, 512, nullptr, logbuf);
-        logger::critical("shader compile failed: {}", logbuf);
-        exit(EXIT_FAILURE);
+void OpenGLRenderer::release_buffers()
+{
+    for (auto &slot : slots_) {
+        if (slot.fence) {
+            glDeleteSync(slot.fence);
+        }
+        if (slot.data) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (slot.pbo) {
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        slot = {};
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    buffer_size_ = 0;
+    next_slot_ = 0;
+}
+
+void OpenGLRenderer::release_textures()
+{
+    for (auto &tex : textures_) {
+        if (tex) {
+            glDeleteTextures(1, &tex);
+            tex = 0;
+        }
     }
+}
 
-    return shader;
+void OpenGLRenderer::wait_fence(UploadSlot &slot)
+{
+    if (!slot.fence) {
+        return;
+    }
+    auto ret = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                kFenceTimeoutNs);
+    if (ret == GL_TIMEOUT_EXPIRED || ret == GL_WAIT_FAILED) {
+        logger::warn("upload buffer still busy, overwrite it");
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
 }
 
-GLuint OpenGLRenderer::create_program(const std::string &vs,
-                                      const std::string &fs)
+void OpenGLRenderer::upload(const webrtc::PlanarYuv8Buffer &yuv,
+                            const webrtc::VideoFrame::UpdateRect &update,
+                            int x, int y, int width, int height)
 {
-    auto vsShader = create_shader(GL_VERTEX_SHADER, vs);
-    auto fsShader = create_shader(GL_FRAGMENT_SHADER, fs);
-    GLuint program = glCreateProgram();
-
-    glAttachShader(program, vsShader);
-    glAttachShader(program, fsShader);
-    glLinkProgram(program);
-    glDetachShader(program, vsShader);
-    glDetachShader(program, fsShader);
-    glDeleteShader(vsShader);
-    glDeleteShader(fsShader);
-
-    int status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (!status) {
-        char logbuf[512] = {0};
-        glGetProgramInfoLog(program, 512, nullptr, logbuf);
-        logger::critical("program link failed: {}", logbuf);
-        exit(EXIT_FAILURE);
-    }
-
-    return program;
+    SDL_GL_MakeCurrent(window_, glctx_);
+    auto rect = update;
+    bool subsampled = yuv.type() != webrtc::VideoFrameBuffer::Type::kI444;
+    // new textures have nothing to update
+    if (allocate(width, height, subsampled ? (width + 1) / 2 : width,
+                 subsampled ? (height + 1) / 2 : height)) {
+        rect = {0, 0, yuv.width(), yuv.height()};
+    }
+    // planes are packed tightly in the upload buffers
+    reserve(sizes_[Y][0] * sizes_[Y][1] + 2 * sizes_[U][0] * sizes_[U][1]);
+
+    auto start_us = rtc::TimeMicros();
+    const uint8_t *planes[3] = {yuv.DataY(), yuv.DataU(), yuv.DataV()};
+    const int strides[3] = {yuv.StrideY(), yuv.StrideU(), yuv.StrideV()};
+    const int plane_sizes[3][2] = {{yuv.width(), yuv.height()},
+                                   {yuv.ChromaWidth(), yuv.ChromaHeight()},
+                                   {yuv.ChromaWidth(), yuv.ChromaHeight()}};
+    // the update rect of each plane in the textures, chroma may be
+    // subsampled
+    int rects[3][4];
+    for (int i : {Y, U, V}) {
+        int sx = subsampled && i != Y ? 2 : 1;
+        int sy = subsampled && i != Y ? 2 : 1;
+        int src_x = rect.offset_x / sx;
+        int src_y = rect.offset_y / sy;
+        rects[i][0] = (x + rect.offset_x) / sx;
+        rects[i][1] = (y + rect.offset_y) / sy;
+        rects[i][2] = std::min({(rect.width + sx - 1) / sx,
+                                plane_sizes[i][0] - src_x,
+                                sizes_[i][0] - rects[i][0]});
+        rects[i][3] = std::min({(rect.height + sy - 1) / sy,
+                                plane_sizes[i][1] - src_y,
+                                sizes_[i][1] - rects[i][1]});
+        planes[i] += src_y * strides[i] + src_x;
+    }
+
+    auto &slot = slots_[next_slot_];
+    bool mapped = slot.data && !rect.IsEmpty();
+    int row_lengths[3] = {strides[Y], strides[U], strides[V]};
+    if (mapped) {
+        // the copy overlaps the uploads still pending from the other slots
+        wait_fence(slot);
+        size_t offset = 0;
+        for (int i : {Y, U, V}) {
+            int w = rects[i][2], h = rects[i][3];
+            libyuv::CopyPlane(planes[i], strides[i], slot.data + offset, w, w,
+                              h);
+            planes[i] = reinterpret_cast<const uint8_t *>(offset);
+            row_lengths[i] = w;
+            offset += w * h;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    }
+
+    // an empty rect uploads nothing and shows the textures as they are
+    for (int i : {Y, U, V}) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures_[i]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, row_lengths[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rects[i][0], rects[i][1],
+                        rects[i][2], rects[i][3], GL_RED, GL_UNSIGNED_BYTE,
+                        planes[i]);
+        upload_bytes_ += rects[i][2] * rects[i][3];
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    if (mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        next_slot_ = (next_slot_ + 1) % kUploadSlots;
+    }
+    upload_us_ += rtc::TimeMicros() - start_us;
 }
 
-void OpenGLRenderer::update_textures(const void *ydata, const void *udata,
-                                     const void *vdata)
+void OpenGLRenderer::present()
 {
     SDL_GL_MakeCurrent(window_, glctx_);
+    for (int i : {Y, U, V}) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures_[i]);
+    }
+
+    // the sampler scales the picture into a letterboxed viewport
+    int width, height;
+    SDL_GL_GetDrawableSize(window_, &width, &height);
+    auto viewport = fit(sizes_[Y][0], sizes_[Y][1], width, height);
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(viewport.x, height - viewport.y - viewport.h, viewport.w,
+               viewport.h);
 
-    glActiveTexture(GL_TEXTURE0 + Y);
-    glBindTexture(GL_TEXTURE_2D, textures_[Y]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, conf_.width, conf_.height, 0,
-                 GL_LUMINANCE, GL_UNSIGNED_BYTE, ydata);
-    glUniform1i(glGetUniformLocation(program_, "uTexY"), Y);
-
-    glActiveTexture(GL_TEXTURE0 + U);
-    glBindTexture(GL_TEXTURE_2D, textures_[U]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, conf_.width / 2,
-                 conf_.height / 2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, udata);
-    glUniform1i(glGetUniformLocation(program_, "uTexU"), U);
-
-    glActiveTexture(GL_TEXTURE0 + V);
-    glBindTexture(GL_TEXTURE_2D, textures_[V]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, conf_.width / 2,
-                 conf_.height / 2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, vdata);
-    glUniform1i(glGetUniformLocation(program_, "uTexV"), V);
-
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
+    quad_->draw();
 
     SDL_GL_SwapWindow(window_);
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "video_renderer.hh"
+#include "yuv_quad.hh"
+
+#include <memory>
 
 struct OpenGLRenderer : public VideoRenderer {
   public:
@@ -7,18 +10,40 @@ struct OpenGLRenderer : public VideoRenderer {
     ~OpenGLRenderer() override;
 
   private:
-    void update_textures(const void *ydata, const void *udata,
-                         const void *vdata) override;
+    void upload(const webrtc::PlanarYuv8Buffer &yuv,
+                const webrtc::VideoFrame::UpdateRect &update, int x, int y,
+                int width, int height) override;
+    void present() override;
+    bool full_chroma() const override { return true; }
+    void on_render_thread_exit() override;
     enum { Y = 0, U = 1, V = 2 };
-    GLuint create_texture();
-    GLuint create_buffer(int location, const float data[], size_t sz);
-    GLuint create_shader(unsigned typ, const std::string &code);
-    GLuint create_program(const std::string &vs, const std::string &fs);
+    // frames in flight between the CPU copy and the texture upload
+    static constexpr int kUploadSlots = 3;
+    static constexpr GLuint64 kFenceTimeoutNs = 100'000'000;
+    struct UploadSlot {
+        GLuint pbo = 0;
+        // persistently mapped, null when uploading from client memory
+        uint8_t *data = nullptr;
+        // the last upload from this slot finished reading it
+        GLsync fence = nullptr;
+    };
+    // textures for planes of these sizes, kept until the sizes change, true
+    // if they are new
+    bool allocate(int width, int height, int cw, int ch);
+    // upload buffers of at least `size` bytes
+    void reserve(size_t size);
+    void release_buffers();
+    void release_textures();
+    void wait_fence(UploadSlot &slot);
 
   private:
     // resources
     SDL_GLContext glctx_ = nullptr;
     GLuint textures_[3] = {0, 0, 0};
-    GLuint vao, vbo, ebo;
-    GLuint program_ = 0;
+    std::unique_ptr<YuvQuad> quad_;
+    UploadSlot slots_[kUploadSlots];
+    // states
+    int sizes_[3][2] = {};
+    size_t buffer_size_ = 0;
+    int next_slot_ = 0;
 };
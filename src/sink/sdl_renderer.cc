@@ -3,35 +3,107 @@
 
 #include <cstdio>
 #include <stdexcept>
+#include <vector>
 
 #include <SDL2/SDL_render.h>
 
 SDLRenderer::SDLRenderer(Config conf) : VideoRenderer(std::move(conf))
 {
-    renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
-    texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_IYUV,
-                                 SDL_TEXTUREACCESS_STREAMING, conf_.width,
-                                 conf_.height);
-    SDL_SetRenderDrawColor(renderer_, 0, 128, 128, 255);
+    // SDL renderers are bound to the thread creating them
+    if (!conf_.render_thread) {
+        create_renderer();
+    }
+}
+
+SDLRenderer::~SDLRenderer()
+{
+    // destroyed by the render thread, see `on_render_thread_exit`
+    stop_render_thread();
+    destroy_renderer();
+}
+
+void SDLRenderer::on_render_thread_exit()
+{
+    // created lazily again by the next render thread
+    destroy_renderer();
+}
+
+void SDLRenderer::create_renderer()
+{
+    uint32_t flags = SDL_RENDERER_ACCELERATED;
+    if (conf_.swap_interval != 0) {
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    renderer_ = SDL_CreateRenderer(window_, -1, flags);
+    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
     SDL_RenderClear(renderer_);
     SDL_RenderPresent(renderer_);
 }
 
-SDLRenderer::~SDLRenderer()
+void SDLRenderer::destroy_renderer()
 {
-    SDL_DestroyTexture(texture_);
-    SDL_DestroyRenderer(renderer_);
+    if (texture_) {
+        SDL_DestroyTexture(texture_);
+        texture_ = nullptr;
+    }
+    if (renderer_) {
+        SDL_DestroyRenderer(renderer_);
+        renderer_ = nullptr;
+    }
+    texture_width_ = texture_height_ = 0;
 }
 
-void SDLRenderer::update_textures(const void *ydata, const void *udata,
-                                  const void *vdata)
+void SDLRenderer::upload(const webrtc::PlanarYuv8Buffer &yuv,
+                         const webrtc::VideoFrame::UpdateRect &update, int x,
+                         int y, int width, int height)
 {
+    // IYUV textures only, see `full_chroma`
+    assert(yuv.type() != webrtc::VideoFrameBuffer::Type::kI444);
+    if (!renderer_) {
+        create_renderer();
+    }
+    SDL_Rect dirty{update.offset_x, update.offset_y, update.width,
+                   update.height};
+    // recreated only when the picture size changes
+    if (!texture_ || width != texture_width_ || height != texture_height_) {
+        if (texture_) {
+            SDL_DestroyTexture(texture_);
+        }
+        texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_IYUV,
+                                     SDL_TEXTUREACCESS_STREAMING, width,
+                                     height);
+        texture_width_ = width;
+        texture_height_ = height;
+        // tile cells may stay empty for a few frames
+        std::vector<uint8_t> black(width * height, 0);
+        std::vector<uint8_t> gray((width + 1) / 2 * ((height + 1) / 2), 128);
+        SDL_UpdateYUVTexture(texture_, nullptr, black.data(), width,
+                             gray.data(), (width + 1) / 2, gray.data(),
+                             (width + 1) / 2);
+        dirty = {0, 0, yuv.width(), yuv.height()};
+    }
     // TODO: use SDL_LockTexture instead?
-    SDL_UpdateYUVTexture(texture_, nullptr, //
-                         static_cast<const uint8_t *>(ydata), conf_.width,
-                         static_cast<const uint8_t *>(udata), conf_.width / 2,
-                         static_cast<const uint8_t *>(vdata), conf_.width / 2);
-    SDL_Rect rect{0, 0, conf_.width, conf_.height};
+    if (dirty.w > 0 && dirty.h > 0) {
+        int cx = dirty.x / 2, cy = dirty.y / 2;
+        // the same area of the cell at `x`, `y` in the texture
+        SDL_Rect target{x + dirty.x, y + dirty.y, dirty.w, dirty.h};
+        SDL_UpdateYUVTexture(
+            texture_, &target,                                           //
+            yuv.DataY() + dirty.y * yuv.StrideY() + dirty.x, yuv.StrideY(), //
+            yuv.DataU() + cy * yuv.StrideU() + cx, yuv.StrideU(),           //
+            yuv.DataV() + cy * yuv.StrideV() + cx, yuv.StrideV());
+    }
+}
+
+void SDLRenderer::present()
+{
+    if (!texture_) {
+        return;
+    }
+    int width, height;
+    SDL_GetRendererOutputSize(renderer_, &width, &height);
+    auto rect = fit(texture_width_, texture_height_, width, height);
+    SDL_RenderClear(renderer_);
     SDL_RenderCopy(renderer_, texture_, nullptr, &rect);
     SDL_RenderPresent(renderer_);
     SDL_RenderFlush(renderer_);
@@ -7,11 +7,19 @@ struct SDLRenderer : public VideoRenderer {
     ~SDLRenderer() override;
 
   private:
-    void update_textures(const void *ydata, const void *udata,
-                         const void *vdata) override;
+    void upload(const webrtc::PlanarYuv8Buffer &yuv,
+                const webrtc::VideoFrame::UpdateRect &update, int x, int y,
+                int width, int height) override;
+    void present() override;
+    void on_render_thread_exit() override;
+    void create_renderer();
+    void destroy_renderer();
 
   private:
     // resources
     SDL_Renderer *renderer_ = nullptr;
     SDL_Texture *texture_ = nullptr;
+    // states
+    int texture_width_ = 0;
+    int texture_height_ = 0;
 };
@@ -1,8 +1,15 @@
 #include "video_renderer.hh"
+#include "codec/dirty_rects.hh"
 #include "logger.hh"
 #include "opengl_renderer.hh"
 #include "sdl_renderer.hh"
+#include "stats/render_stats.hh"
 
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <algorithm>
 #include <cstdio>
 #include <stdexcept>
 
@@ -13,6 +20,8 @@
 #include <SDL2/SDL_version.h>
 #include <SDL2/SDL_video.h>
 
+#include "rtc_base/time_utils.h"
+
 rtc::scoped_refptr<VideoRenderer> VideoRenderer::Create(Config conf)
 {
     if (conf.use_opengl) {
@@ -33,20 +42,83 @@ VideoRenderer::VideoRenderer(Config conf) : conf_(std::move(conf))
                                conf_.height, flags);
 }
 
-VideoRenderer::~VideoRenderer() { SDL_DestroyWindow(window_); }
+VideoRenderer::~VideoRenderer()
+{
+    stop_render_thread();
+    SDL_DestroyWindow(window_);
+}
 
 void VideoRenderer::Start()
 {
     running_ = true;
+    // window calls belong to the thread owning the window, not the renderer
     SDL_ShowWindow(window_);
+    conf_.hide = false;
+    if (conf_.render_thread) {
+        start_render_thread();
+    }
 }
 
 void VideoRenderer::Stop()
 {
+    stop_render_thread();
     running_ = false;
     SDL_HideWindow(window_);
 }
 
+void VideoRenderer::start_render_thread()
+{
+    // called once per track
+    if (render_thread_.joinable()) {
+        return;
+    }
+    render_quit_ = false;
+    render_thread_ = std::thread(&VideoRenderer::render_loop, this);
+}
+
+void VideoRenderer::stop_render_thread()
+{
+    if (!render_thread_.joinable()) {
+        return;
+    }
+    render_quit_ = true;
+    wake();
+    render_thread_.join();
+}
+
+void VideoRenderer::render_loop()
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME, reinterpret_cast<unsigned long>("video_render"));
+#endif
+    logger::debug("start render thread of {}", conf_.name);
+    while (!render_quit_) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait_for(lock, kIdleWake, [this] {
+                return frame_ready_ || render_quit_;
+            });
+            frame_ready_ = false;
+        }
+        if (render_quit_) {
+            break;
+        }
+        // the swap blocks until vsync, unless immediate
+        update_frame();
+    }
+    on_render_thread_exit();
+    logger::debug("stop render thread of {}", conf_.name);
+}
+
+void VideoRenderer::wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        frame_ready_ = true;
+    }
+    wake_cv_.notify_one();
+}
+
 /*
 webrtc::WindowId VideoRenderer::get_native_window_handle() const
 {
@@ -62,6 +134,18 @@ webrtc::WindowId VideoRenderer::get_native_window_handle() const
 }
 */
 
+// even and within the frame, so the chroma planes have whole samples of it
+static webrtc::VideoFrame::UpdateRect
+align_update(const webrtc::VideoFrame::UpdateRect &rect, int width, int height)
+{
+    int left = std::clamp(rect.offset_x & ~1, 0, width);
+    int top = std::clamp(rect.offset_y & ~1, 0, height);
+    int right = std::clamp((rect.offset_x + rect.width + 1) & ~1, left, width);
+    int bottom =
+        std::clamp((rect.offset_y + rect.height + 1) & ~1, top, height);
+    return {left, top, right - left, bottom - top};
+}
+
 // running on capture thread (local) or worker thread (remote)?
 void VideoRenderer::OnFrame(const webrtc::VideoFrame &frame)
 {
@@ -71,7 +155,47 @@ void VideoRenderer::OnFrame(const webrtc::VideoFrame &frame)
     }
     once++;
 
-    frame_queue_.try_push(frame.video_frame_buffer());
+    webrtc::VideoFrame pending = frame;
+    webrtc::VideoFrame::UpdateRect update{0, 0, frame.width(), frame.height()};
+    // changed since the last frame this sink got, frames it never got (e.g.
+    // dropped before the sink, or a new stream) break the chain and the
+    // frame is uploaded in full
+    if (auto changed = DirtyRects::instance().since(last_timestamp_,
+                                                    frame.timestamp())) {
+        update = *changed;
+    }
+    last_timestamp_ = frame.timestamp();
+    // changes of a frame that may never be shown are uploaded with this one,
+    // if it's taken meanwhile they are uploaded twice but never missed
+    if (mailbox_.pending()) {
+        update.Union(pending_update_);
+    }
+    pending_update_ = update;
+    pending.set_update_rect(update);
+
+    // the render loop is behind, the older frame will never be shown
+    if (mailbox_.put(pending) && conf_.stats) {
+        RenderStats::instance().overwrite();
+    }
+    wake();
+}
+
+void VideoRenderer::OnTile(const webrtc::VideoFrame &frame, int index,
+                           int columns, int rows)
+{
+    {
+        // only the newest frame of a tile is uploaded, by the render thread
+        std::lock_guard<std::mutex> lock(tiles_mutex_);
+        if (columns != tile_columns_ || rows != tile_rows_) {
+            tiles_.assign(columns * rows, std::nullopt);
+            tiles_dirty_.assign(columns * rows, false);
+            tile_columns_ = columns;
+            tile_rows_ = rows;
+        }
+        tiles_[index] = frame;
+        tiles_dirty_[index] = true;
+    }
+    wake();
 }
 
 void VideoRenderer::update_frame()
@@ -79,28 +203,132 @@ void VideoRenderer::update_frame()
     if (!running_)
         return;
 
-    if (conf_.hide) {
-        SDL_ShowWindow(window_);
-        conf_.hide = false;
+    upload_us_ = 0;
+    upload_bytes_ = 0;
+    if (!upload_tiles() && !upload_frame()) {
+        return;
+    }
+    present();
+
+    auto now_us = rtc::TimeMicros();
+    if (conf_.stats && last_present_us_ > 0) {
+        RenderStats::instance().add({now_us, now_us - last_present_us_,
+                                     upload_us_, upload_bytes_});
     }
+    last_present_us_ = now_us;
+}
 
-    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame = nullptr;
-    frame_queue_.try_pull(frame);
-    if (!frame) {
-        return;
+bool VideoRenderer::upload_frame()
+{
+    auto taken = mailbox_.take();
+    if (!taken) {
+        return false;
     }
+    auto frame = taken->video_frame_buffer();
+    auto update =
+        align_update(taken->update_rect(), frame->width(), frame->height());
 
-    auto scaled = frame->Scale(conf_.width, conf_.height);
-    auto yuv = scaled->GetI420();
-    if (yuv) {
-        update_textures(yuv->DataY(), yuv->DataU(), yuv->DataV());
+    if (frame->type() == webrtc::VideoFrameBuffer::Type::kI444 &&
+        full_chroma()) {
+        upload(*frame->GetI444(), update, 0, 0, frame->width(),
+               frame->height());
+        return true;
+    }
+    auto yuv = frame->ToI420();
+    if (!yuv) {
+        return false;
+    }
+    upload(*yuv, update, 0, 0, yuv->width(), yuv->height());
+    return true;
+}
+
+bool VideoRenderer::upload_tiles()
+{
+    std::vector<std::optional<webrtc::VideoFrame>> tiles;
+    std::vector<bool> dirty;
+    int columns, rows;
+    {
+        std::lock_guard<std::mutex> lock(tiles_mutex_);
+        if (std::find(tiles_dirty_.begin(), tiles_dirty_.end(), true) ==
+            tiles_dirty_.end()) {
+            return false;
+        }
+        tiles = tiles_;
+        dirty = tiles_dirty_;
+        columns = tile_columns_;
+        rows = tile_rows_;
+        std::fill(tiles_dirty_.begin(), tiles_dirty_.end(), false);
+    }
+
+    // tiles of a column are as wide as each other, and of a row as high, a
+    // cell nothing arrived for yet is assumed to be like the others
+    std::vector<int> widths(columns, 0);
+    std::vector<int> heights(rows, 0);
+    int any_width = 0, any_height = 0;
+    for (int i = 0; i < columns * rows; i++) {
+        if (tiles[i]) {
+            any_width = widths[i % columns] = tiles[i]->width();
+            any_height = heights[i / columns] = tiles[i]->height();
+        }
+    }
+    std::replace(widths.begin(), widths.end(), 0, any_width);
+    std::replace(heights.begin(), heights.end(), 0, any_height);
+    // the picture is reallocated, every tile goes into it again
+    if (widths != cell_widths_ || heights != cell_heights_) {
+        cell_widths_ = widths;
+        cell_heights_ = heights;
+        std::fill(dirty.begin(), dirty.end(), true);
+    }
+
+    int width = 0, height = 0;
+    for (int w : widths) {
+        width += w;
+    }
+    for (int h : heights) {
+        height += h;
+    }
+    for (int i = 0; i < columns * rows; i++) {
+        if (!tiles[i] || !dirty[i]) {
+            continue;
+        }
+        int x = 0, y = 0;
+        for (int c = 0; c < i % columns; c++) {
+            x += widths[c];
+        }
+        for (int r = 0; r < i / columns; r++) {
+            y += heights[r];
+        }
+        // at their source size, the GPU scales the whole picture once
+        auto yuv = tiles[i]->video_frame_buffer()->ToI420();
+        if (!yuv) {
+            continue;
+        }
+        upload(*yuv, {0, 0, yuv->width(), yuv->height()}, x, y, width,
+               height);
+    }
+    return true;
+}
+
+SDL_Rect VideoRenderer::fit(int width, int height, int out_width,
+                            int out_height)
+{
+    if (width <= 0 || height <= 0) {
+        return {0, 0, out_width, out_height};
+    }
+    // letterbox or pillarbox, whichever side is too long
+    int w = out_width, h = out_height;
+    if (int64_t(width) * out_height > int64_t(height) * out_width) {
+        h = static_cast<int>(int64_t(height) * out_width / width);
+    } else {
+        w = static_cast<int>(int64_t(width) * out_height / height);
     }
+    return {(out_width - w) / 2, (out_height - h) / 2, w, h};
 }
 
 void VideoRenderer::dump_frame(const webrtc::VideoFrame &frame, int id)
 {
     auto buf = frame.video_frame_buffer();
-    auto yuv = buf->GetI420();
+    auto yuv = buf->ToI420();
     char name[20] = {0};
     sprintf(name, "frame-%02d.yuv", id);
     ::FILE *f = ::fopen(name, "wb+");
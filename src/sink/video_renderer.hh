@@ -1,13 +1,21 @@
 #pragma once
 
+#include "frame_mailbox.hh"
 #include "video_sink.hh"
 
 // #include <queue>
-#include <boost/thread/sync_queue.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
 
+#include "api/video/i420_buffer.h"
 #include "api/video/video_frame.h"
 #include "modules/desktop_capture/desktop_capture_types.h"
 
@@ -20,10 +28,18 @@ struct VideoRenderer : public VideoSink {
         bool use_opengl = false;
         bool dump = false;
         bool hide = true;
+        // present from an own thread woken by frame arrival, instead of the
+        // owner calling `update_frame`
+        bool render_thread = false;
+        // as SDL_GL_SetSwapInterval: 1 vsync, -1 adaptive vsync (tear if
+        // late), 0 immediate
+        int swap_interval = 1;
+        // record present times in `RenderStats`
+        bool stats = false;
     };
 
-    using FrameQueue =
-        boost::sync_queue<rtc::scoped_refptr<webrtc::VideoFrameBuffer>>;
+    // the render thread also wakes this often without frames
+    static constexpr auto kIdleWake = std::chrono::milliseconds(100);
 
   public:
     static rtc::scoped_refptr<VideoRenderer> Create(Config conf);
@@ -37,16 +53,41 @@ struct VideoRenderer : public VideoSink {
     // impl VideoSink
     void Start() override;
     void Stop() override;
+    void OnTile(const webrtc::VideoFrame &frame, int index, int columns,
+                int rows) override;
 
     // TODO: CRTP?
-    virtual void update_textures(const void *ydata, const void *udata,
-                                 const void *vdata) = 0;
+    // `update` of `yuv` (native size and strides, I444 or I420) into the
+    // same area offset by `x`, `y` of a `width`x`height` picture, on even
+    // coordinates. Textures are reallocated when the picture size changes.
+    virtual void upload(const webrtc::PlanarYuv8Buffer &yuv,
+                        const webrtc::VideoFrame::UpdateRect &update, int x,
+                        int y, int width, int height) = 0;
+    // the uploaded picture, scaled into the window by the GPU
+    virtual void present() = 0;
+    // I444 frames are drawn with full chroma, otherwise converted to I420
+    virtual bool full_chroma() const { return false; }
 
   protected:
     explicit VideoRenderer(Config conf);
 
+    // must be called by derived destructors before their resources go
+    void stop_render_thread();
+    // last call on the render thread, release what is bound to it
+    virtual void on_render_thread_exit() {}
+    // a `width`x`height` frame scaled into `out_width`x`out_height`, keeping
+    // its aspect ratio
+    static SDL_Rect fit(int width, int height, int out_width, int out_height);
+
   private:
+    void start_render_thread();
+    void render_loop();
+    // a frame is ready for the render thread
+    void wake();
     void dump_frame(const webrtc::VideoFrame &frame, int id = 0);
+    // false if there was nothing new to upload
+    bool upload_frame();
+    bool upload_tiles();
 
   protected:
     // resources
@@ -55,6 +96,34 @@ struct VideoRenderer : public VideoSink {
     Config conf_;
     // states
     bool running_ = false;
+    // spent copying the last frame to the GPU and its size, added up by
+    // `upload`
+    int64_t upload_us_ = 0;
+    int64_t upload_bytes_ = 0;
+
+    // the newest frame not rendered yet
+    FrameMailbox mailbox_;
+    // the newest frame of every tile, each is uploaded into its own cell
+    std::mutex tiles_mutex_;
+    std::vector<std::optional<webrtc::VideoFrame>> tiles_;
+    std::vector<bool> tiles_dirty_;
+    int tile_columns_ = 0;
+    int tile_rows_ = 0;
 
-    FrameQueue frame_queue_;
+  private:
+    // resources
+    std::thread render_thread_;
+    // states
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool frame_ready_ = false;
+    std::atomic<bool> render_quit_ = false;
+    int64_t last_present_us_ = 0;
+    // of the frame last put into `mailbox_`
+    webrtc::VideoFrame::UpdateRect pending_update_ = {0, 0, 0, 0};
+    // RTP timestamp of the last frame received, see `DirtyRects`
+    uint32_t last_timestamp_ = 0;
+    // cell sizes of the uploaded tiles, by column and by row
+    std::vector<int> cell_widths_;
+    std::vector<int> cell_heights_;
 };
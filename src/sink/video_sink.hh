@@ -8,6 +8,33 @@ struct VideoSink : public rtc::VideoSinkInterface<webrtc::VideoFrame>,
 
     virtual void Start() = 0;
     virtual void Stop() = 0;
+    // a cell of a `columns`x`rows` grid of tile streams, sinks which can't
+    // compose them only show the first one
+    virtual void OnTile(const webrtc::VideoFrame &frame, int index,
+                        int columns, int rows)
+    {
+        if (index == 0) {
+            OnFrame(frame);
+        }
+    }
 
     ~VideoSink() override = default;
 };
+
+// feeds the frames of one tile track into a composing `VideoSink`
+struct TileSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+    TileSink(VideoSink *sink, int index, int columns, int rows)
+        : sink_(sink), index_(index), columns_(columns), rows_(rows)
+    {
+    }
+
+    void OnFrame(const webrtc::VideoFrame &frame) override
+    {
+        sink_->OnTile(frame, index_, columns_, rows_);
+    }
+
+    VideoSink *sink_;
+    int index_;
+    int columns_;
+    int rows_;
+};
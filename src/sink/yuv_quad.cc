@@ -0,0 +1,159 @@
+#include "yuv_quad.hh"
+#include "logger.hh"
+
+#include <cstdlib>
+
+// core profile GLSL, offscreen contexts don't have the compatibility one
+static const std::string vs_src = R"(
+    #version 330 core
+
+    layout (location = 0) in vec2 aPosition;
+    layout (location = 1) in vec2 aTexCoord;
+
+    out vec2 vTexCoord;
+
+    void main() {
+      gl_Position = vec4(aPosition, 0.0, 1.0);
+      vTexCoord = aTexCoord;
+    }
+)";
+static const std::string fs_src = R"(
+    #version 330 core
+
+    in vec2 vTexCoord;
+    out vec4 fragColor;
+
+    uniform sampler2D uTexY;
+    uniform sampler2D uTexU;
+    uniform sampler2D uTexV;
+
+    void main() {
+      vec3 yuv;
+      vec3 rgb;
+      yuv.x = texture(uTexY, vTexCoord).r;
+      yuv.y = texture(uTexU, vTexCoord).r - 0.5;
+      yuv.z = texture(uTexV, vTexCoord).r - 0.5;
+      rgb = mat3( 1,       1,         1,
+                  0,       -0.39465,  2.03211,
+                  1.13983, -0.58060,  0) * yuv;
+      fragColor = vec4(rgb, 1);
+    }
+)";
+static const float vertices[] = {
+    // position|texcoord
+    -1.0, -1.0, 0.0, 1.0, // lt
+    +1.0, -1.0, 1.0, 1.0, // rt
+    -1.0, +1.0, 0.0, 0.0, // lb
+    +1.0, +1.0, 1.0, 0.0, // rb
+};
+
+static const int indices[] = {
+    0, 1, 2, //
+    1, 2, 3, //
+};
+
+YuvQuad::YuvQuad()
+{
+    program_ = create_program(vs_src, fs_src);
+    glUseProgram(program_);
+    // samplers stay bound to their texture units
+    glUniform1i(glGetUniformLocation(program_, "uTexY"), 0);
+    glUniform1i(glGetUniformLocation(program_, "uTexU"), 1);
+    glUniform1i(glGetUniformLocation(program_, "uTexV"), 2);
+
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &vbo_);
+    glGenBuffers(1, &ebo_);
+
+    glBindVertexArray(vao_);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+                 GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, false, 4 * sizeof(float), nullptr);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, false, 4 * sizeof(float), (void *)8);
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+}
+
+YuvQuad::~YuvQuad()
+{
+    glDeleteBuffers(1, &ebo_);
+    glDeleteBuffers(1, &vbo_);
+    glDeleteVertexArrays(1, &vao_);
+    glDeleteProgram(program_);
+}
+
+void YuvQuad::draw() const
+{
+    glUseProgram(program_);
+    glBindVertexArray(vao_);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+}
+
+GLuint YuvQuad::create_texture()
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return tex;
+}
+
+GLuint YuvQuad::create_shader(unsigned typ, const std::string &code)
+{
+    const char *src = code.c_str();
+    GLuint shader = glCreateShader(typ);
+    glShaderSource(shader, 1, &src, nullptr);
+    glCompileShader(shader);
+
+    int status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+    if (!status) {
+        char logbuf[512] = {0};
+        glGetShaderInfoLog(shader, 512, nullptr, logbuf);
+        logger::critical("shader compile failed: {}", logbuf);
+        exit(EXIT_FAILURE);
+    }
+
+    return shader;
+}
+
+GLuint YuvQuad::create_program(const std::string &vs,
+                                      const std::string &fs)
+{
+    auto vsShader = create_shader(GL_VERTEX_SHADER, vs);
+    auto fsShader = create_shader(GL_FRAGMENT_SHADER, fs);
+    GLuint program = glCreateProgram();
+
+    glAttachShader(program, vsShader);
+    glAttachShader(program, fsShader);
+    glLinkProgram(program);
+    glDetachShader(program, vsShader);
+    glDetachShader(program, fsShader);
+    glDeleteShader(vsShader);
+    glDeleteShader(fsShader);
+
+    int status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        char logbuf[512] = {0};
+        glGetProgramInfoLog(program, 512, nullptr, logbuf);
+        logger::critical("program link failed: {}", logbuf);
+        exit(EXIT_FAILURE);
+    }
+
+    return program;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+
+#include <GL/glew.h>
+
+// The YUV to RGB program and the quad it's drawn on, shared by the OpenGL
+// sinks. Planes are R8 textures bound to texture units 0, 1 and 2. Created,
+// drawn and destroyed with the same context current.
+class YuvQuad
+{
+  public:
+    YuvQuad();
+    ~YuvQuad();
+
+    // fills the current viewport
+    void draw() const;
+
+    // a plane texture without storage yet
+    static GLuint create_texture();
+
+  private:
+    static GLuint create_shader(unsigned typ, const std::string &code);
+    static GLuint create_program(const std::string &vs, const std::string &fs);
+
+  private:
+    // resources
+    GLuint program_ = 0;
+    GLuint vao_ = 0;
+    GLuint vbo_ = 0;
+    GLuint ebo_ = 0;
+};
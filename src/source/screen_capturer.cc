@@ -11,9 +11,11 @@
 #include <vector>
 
 #include "api/video/i420_buffer.h"
+#include "api/video/i444_buffer.h"
 #include "api/video/video_frame.h"
 #include "api/video/video_sink_interface.h"
 #include "api/video/video_source_interface.h"
+#include "common_video/include/video_frame_buffer_pool.h"
 #include "rtc_base/time_utils.h"
 
 #include "modules/desktop_capture/desktop_capture_options.h"
@@ -21,6 +23,8 @@
 
 #include <SDL2/SDL_video.h>
 #include <libyuv/convert.h>
+#include <libyuv/convert_from_argb.h>
+#include <libyuv/scale.h>
 #include <libyuv/video_common.h>
 
 class ScreenCaptureImpl : public VideoSource,
@@ -31,11 +35,14 @@ class ScreenCaptureImpl : public VideoSource,
         kWindow = 0,
         kScreen = 1,
     };
+    // captured frames held by the sinks at once, e.g. the encoder queues of
+    // tile tracks and a local preview
+    static constexpr size_t kMaxPooledFrames = 16;
 
   public:
     ScreenCaptureImpl(const ScreenCapturer::Config &conf,
                       CaptureType kind = CaptureType::kScreen)
-        : conf_(conf)
+        : pool_(false, kMaxPooledFrames), conf_(conf)
     {
         auto opts = webrtc::DesktopCaptureOptions::CreateDefault();
 #ifdef __linux__
@@ -45,8 +52,10 @@ class ScreenCaptureImpl : public VideoSource,
         auto xdisplay = webrtc::SharedXDisplay::CreateDefault();
         opts.set_x_display(xdisplay);
         // opts.set_prefer_cursor_embedded(true);
-        // opts.set_detect_updated_region(true);
 #endif
+        // compare with the previous frame, static screens are refined by
+        // the encoder, see `FFMPEGEncoder::Config::refine_after`
+        opts.set_detect_updated_region(true);
 
         if (kind == CaptureType::kScreen) {
             desktop_capturer_ =
@@ -71,7 +80,6 @@ class ScreenCaptureImpl : public VideoSource,
             desktop_capturer_->SetExcludedWindow(id);
         }
 
-        scaled_buffer_ = webrtc::I420Buffer::Create(conf_.width, conf_.height);
         // Start should only be called once
         desktop_capturer_->Start(this);
     }
@@ -122,18 +130,59 @@ class ScreenCaptureImpl : public VideoSource,
             return;
         }
 
+        auto buffer = conf_.i444 ? to_i444(*frame) : to_i420(*frame);
+        if (!buffer) {
+            logger::warn("all capture buffers are held, drop frame");
+            return;
+        }
+
+        webrtc::VideoFrame::UpdateRect update{0, 0, 0, 0};
+        for (webrtc::DesktopRegion::Iterator it(frame->updated_region());
+             !it.IsAtEnd(); it.Advance()) {
+            const auto &r = it.rect();
+            update.Union({r.left(), r.top(), r.width(), r.height()});
+        }
+        update = update.ScaleWithFrame(
+            frame->size().width(), frame->size().height(), 0, 0,
+            frame->size().width(), frame->size().height(), buffer->width(),
+            buffer->height());
+
+        webrtc::VideoFrame::Builder builder;
+        auto captured_frame = builder.set_rotation(webrtc::kVideoRotation_0)
+                                  .set_id(id++)
+                                  .set_timestamp_us(rtc::TimeMicros())
+                                  .set_video_frame_buffer(buffer)
+                                  .set_update_rect(update)
+                                  .build();
+
+        // send to sinks
+        std::for_each(sinks_.begin(), sinks_.end(),
+                      [&captured_frame](const SinkPair &pair) {
+                          pair.sink->OnFrame(captured_frame);
+                      });
+    }
+
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+    to_i420(const webrtc::DesktopFrame &frame)
+    {
+        // sinks read frames on their own queues after this returns, so
+        // every frame gets a buffer of its own
+        auto scaled_buffer = pool_.CreateI420Buffer(conf_.width, conf_.height);
+        if (!scaled_buffer) {
+            return nullptr;
+        }
         if (!origin_buffer_)
-            origin_buffer_ = webrtc::I420Buffer::Create(frame->size().width(),
-                                                        frame->size().height());
+            origin_buffer_ = webrtc::I420Buffer::Create(frame.size().width(),
+                                                        frame.size().height());
 
         libyuv::ConvertToI420(
-            frame->data(), 0,                                          //
+            frame.data(), 0,                                           //
             origin_buffer_->MutableDataY(), origin_buffer_->StrideY(), //
             origin_buffer_->MutableDataU(), origin_buffer_->StrideU(), //
             origin_buffer_->MutableDataV(), origin_buffer_->StrideV(), //
             0, 0,                                                      //
-            frame->size().width(), frame->size().height(),             //
-            frame->size().width(), frame->size().height(),             //
+            frame.size().width(), frame.size().height(),               //
+            frame.size().width(), frame.size().height(),               //
             libyuv::kRotate0, libyuv::FOURCC_ARGB);
 
         libyuv::I420Scale(
@@ -141,24 +190,46 @@ class ScreenCaptureImpl : public VideoSource,
             origin_buffer_->DataU(), origin_buffer_->StrideU(),        //
             origin_buffer_->DataV(), origin_buffer_->StrideV(),        //
             origin_buffer_->width(), origin_buffer_->height(),         //
-            scaled_buffer_->MutableDataY(), scaled_buffer_->StrideY(), //
-            scaled_buffer_->MutableDataU(), scaled_buffer_->StrideU(), //
-            scaled_buffer_->MutableDataV(), scaled_buffer_->StrideV(), //
-            scaled_buffer_->width(), scaled_buffer_->height(),         //
+            scaled_buffer->MutableDataY(), scaled_buffer->StrideY(),   //
+            scaled_buffer->MutableDataU(), scaled_buffer->StrideU(),   //
+            scaled_buffer->MutableDataV(), scaled_buffer->StrideV(),   //
+            scaled_buffer->width(), scaled_buffer->height(),           //
             libyuv::kFilterBox);
+        return scaled_buffer;
+    }
 
-        webrtc::VideoFrame::Builder builder;
-        auto captured_frame = builder.set_rotation(webrtc::kVideoRotation_0)
-                                  .set_id(id++)
-                                  .set_timestamp_us(rtc::TimeMicros())
-                                  .set_video_frame_buffer(scaled_buffer_)
-                                  .build();
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+    to_i444(const webrtc::DesktopFrame &frame)
+    {
+        auto width = frame.size().width();
+        auto height = frame.size().height();
+        auto scaled444_buffer =
+            pool_.CreateI444Buffer(conf_.width, conf_.height);
+        if (!scaled444_buffer) {
+            return nullptr;
+        }
+        if (!origin444_buffer_) {
+            origin444_buffer_ = webrtc::I444Buffer::Create(width, height);
+        }
 
-        // send to sinks
-        std::for_each(sinks_.begin(), sinks_.end(),
-                      [&captured_frame](const SinkPair &pair) {
-                          pair.sink->OnFrame(captured_frame);
-                      });
+        libyuv::ARGBToI444(
+            frame.data(), frame.stride(),                                    //
+            origin444_buffer_->MutableDataY(), origin444_buffer_->StrideY(), //
+            origin444_buffer_->MutableDataU(), origin444_buffer_->StrideU(), //
+            origin444_buffer_->MutableDataV(), origin444_buffer_->StrideV(), //
+            width, height);
+
+        libyuv::I444Scale(
+            origin444_buffer_->DataY(), origin444_buffer_->StrideY(),        //
+            origin444_buffer_->DataU(), origin444_buffer_->StrideU(),        //
+            origin444_buffer_->DataV(), origin444_buffer_->StrideV(),        //
+            width, height,                                                   //
+            scaled444_buffer->MutableDataY(), scaled444_buffer->StrideY(),   //
+            scaled444_buffer->MutableDataU(), scaled444_buffer->StrideU(),   //
+            scaled444_buffer->MutableDataV(), scaled444_buffer->StrideV(),   //
+            scaled444_buffer->width(), scaled444_buffer->height(),           //
+            libyuv::kFilterBox);
+        return scaled444_buffer;
     }
 
   private:
@@ -166,7 +237,9 @@ class ScreenCaptureImpl : public VideoSource,
     std::thread thread_;
     std::atomic<bool> running_ = false;
     rtc::scoped_refptr<webrtc::I420Buffer> origin_buffer_;
-    rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer_;
+    rtc::scoped_refptr<webrtc::I444Buffer> origin444_buffer_;
+    // the scaled frames handed out to the sinks
+    webrtc::VideoFrameBufferPool pool_;
     ScreenCapturer::Config conf_;
 };
 
@@ -16,6 +16,8 @@ struct ScreenCapturer : public VideoTrackSource {
         int height = 0;
         bool keep_ratio = true;
         std::vector<webrtc::WindowId> exlude_window_id;
+        // full chroma I444 frames instead of I420
+        bool i444 = false;
     };
 
   public:
@@ -0,0 +1,123 @@
+#include "tile_source.hh"
+#include "logger.hh"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "api/video/i420_buffer.h"
+#include "common_video/include/video_frame_buffer.h"
+
+// even offsets, chroma planes are subsampled
+static int cell_edge(int size, int cells, int i)
+{
+    return (size * i / cells) & ~1;
+}
+
+rtc::scoped_refptr<TileSource>
+TileSource::Create(rtc::scoped_refptr<VideoTrackSource> parent, Config conf,
+                   std::shared_ptr<Converter> converter)
+{
+    return rtc::make_ref_counted<TileSource>(std::move(parent), conf,
+                                             std::move(converter));
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> TileSource::Converter::convert(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer> &buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // `source_` is held, so its address isn't reused by a newer frame
+    if (buffer != source_) {
+        source_ = buffer;
+        converted_ = buffer->ToI420();
+    }
+    return converted_;
+}
+
+std::string TileSource::Label(const std::string &prefix, const Config &conf)
+{
+    return fmt::format("{}.{}.{}.{}", prefix, conf.index, conf.columns,
+                       conf.rows);
+}
+
+bool TileSource::ParseLabel(const std::string &prefix,
+                            const std::string &label, Config &conf)
+{
+    if (!label.starts_with(prefix + ".")) {
+        return false;
+    }
+    return std::sscanf(label.c_str() + prefix.size(), ".%d.%d.%d", &conf.index,
+                       &conf.columns, &conf.rows) == 3 &&
+           conf.columns > 0 && conf.rows > 0 && conf.index >= 0 &&
+           conf.index < conf.columns * conf.rows;
+}
+
+TileSource::TileSource(rtc::scoped_refptr<VideoTrackSource> parent,
+                       Config conf, std::shared_ptr<Converter> converter)
+    : VideoTrackSource(false), parent_(std::move(parent)),
+      converter_(std::move(converter)), conf_(conf)
+{
+    logger::debug("TileSource {} of {}x{} created", conf_.index, conf_.columns,
+                  conf_.rows);
+}
+
+TileSource::~TileSource()
+{
+    if (state() == kLive) {
+        Stop();
+    }
+}
+
+void TileSource::Start()
+{
+    SetState(SourceState::kLive);
+    parent_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+void TileSource::Stop()
+{
+    parent_->RemoveSink(this);
+    SetState(SourceState::kEnded);
+}
+
+void TileSource::OnFrame(const webrtc::VideoFrame &frame)
+{
+    // every tile of the grid crops the same converted frame
+    auto buffer = converter_->convert(frame.video_frame_buffer());
+    if (!buffer) {
+        return;
+    }
+    int col = conf_.index % conf_.columns;
+    int row = conf_.index / conf_.columns;
+    int x = cell_edge(buffer->width(), conf_.columns, col);
+    int y = cell_edge(buffer->height(), conf_.rows, row);
+    int w = cell_edge(buffer->width(), conf_.columns, col + 1) - x;
+    int h = cell_edge(buffer->height(), conf_.rows, row + 1) - y;
+
+    // no copy, the tile keeps the whole frame alive
+    auto tile = webrtc::WrapI420Buffer(
+        w, h,                                                            //
+        buffer->DataY() + y * buffer->StrideY() + x, buffer->StrideY(),  //
+        buffer->DataU() + y / 2 * buffer->StrideU() + x / 2,             //
+        buffer->StrideU(),                                               //
+        buffer->DataV() + y / 2 * buffer->StrideV() + x / 2,             //
+        buffer->StrideV(),                                               //
+        [buffer] {});
+
+    webrtc::VideoFrame::UpdateRect update{0, 0, w, h};
+    if (frame.has_update_rect()) {
+        update = frame.update_rect();
+        update.Intersect({x, y, w, h});
+        if (!update.IsEmpty()) {
+            update.offset_x -= x;
+            update.offset_y -= y;
+        }
+    }
+
+    broadcaster_.OnFrame(webrtc::VideoFrame::Builder()
+                             .set_video_frame_buffer(tile)
+                             .set_timestamp_us(frame.timestamp_us())
+                             .set_rotation(frame.rotation())
+                             .set_id(frame.id())
+                             .set_update_rect(update)
+                             .build());
+}
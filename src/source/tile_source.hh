@@ -0,0 +1,72 @@
+#pragma once
+
+#include "video_source.hh"
+
+#include <memory>
+#include <mutex>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "media/base/video_broadcaster.h"
+
+// One cell of a `columns`x`rows` grid over another source. Every tile is sent
+// as its own track, so each gets its own encoder on its own encoder queue and
+// stays within the level limits of a single stream.
+struct TileSource : public VideoTrackSource,
+                    public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+  public:
+    struct Config {
+        int index = 0;
+        int columns = 1;
+        int rows = 1;
+    };
+
+    // the I420 version of the parent's latest frame, converted by whichever
+    // tile of a grid gets the frame first
+    class Converter
+    {
+      public:
+        rtc::scoped_refptr<webrtc::I420BufferInterface>
+        convert(const rtc::scoped_refptr<webrtc::VideoFrameBuffer> &buffer);
+
+      private:
+        std::mutex mutex_;
+        rtc::scoped_refptr<webrtc::VideoFrameBuffer> source_;
+        rtc::scoped_refptr<webrtc::I420BufferInterface> converted_;
+    };
+
+  public:
+    TileSource(rtc::scoped_refptr<VideoTrackSource> parent, Config conf,
+               std::shared_ptr<Converter> converter);
+    ~TileSource() override;
+
+    // tiles of one grid share `converter`
+    static rtc::scoped_refptr<TileSource>
+    Create(rtc::scoped_refptr<VideoTrackSource> parent, Config conf,
+           std::shared_ptr<Converter> converter);
+
+    // stream id of a tile, see `ParseLabel`
+    static std::string Label(const std::string &prefix, const Config &conf);
+    static bool ParseLabel(const std::string &prefix, const std::string &label,
+                           Config &conf);
+
+  public:
+    rtc::VideoSourceInterface<webrtc::VideoFrame> *source() override
+    {
+        return &broadcaster_;
+    }
+
+    // the parent is started and stopped by its owner
+    void Start() override;
+    void Stop() override;
+
+    // impl VideoSinkInterface
+    void OnFrame(const webrtc::VideoFrame &frame) override;
+
+  private:
+    rtc::scoped_refptr<VideoTrackSource> parent_;
+    rtc::VideoBroadcaster broadcaster_;
+    std::shared_ptr<Converter> converter_;
+    Config conf_;
+};
@@ -0,0 +1,27 @@
+#include "tile_source.hh"
+
+#include <cassert>
+#include <cstdio>
+
+int main(int argc, char *argv[])
+{
+    TileSource::Config conf;
+    auto label = TileSource::Label("screen", {.index = 5, .columns = 3,
+                                              .rows = 2});
+    assert(label == "screen.5.3.2");
+    assert(TileSource::ParseLabel("screen", label, conf));
+    assert(conf.index == 5 && conf.columns == 3 && conf.rows == 2);
+
+    // other streams, or a prefix of them
+    assert(!TileSource::ParseLabel("screen", "camera.0.1.1", conf));
+    assert(!TileSource::ParseLabel("screen", "screenshare.0.1.1", conf));
+    assert(!TileSource::ParseLabel("screen", "screen", conf));
+    // incomplete or outside of the grid
+    assert(!TileSource::ParseLabel("screen", "screen.0.1", conf));
+    assert(!TileSource::ParseLabel("screen", "screen.6.3.2", conf));
+    assert(!TileSource::ParseLabel("screen", "screen.-1.3.2", conf));
+    assert(!TileSource::ParseLabel("screen", "screen.0.0.2", conf));
+
+    std::printf("tile source tests passed\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "decoder_stats.hh"
+
+#include <algorithm>
+
+#include <nlohmann/json.hpp>
+
+DecoderStats &DecoderStats::instance()
+{
+    static DecoderStats stats;
+    return stats;
+}
+
+std::string DecoderStats::summary(size_t window) const
+{
+    using json = nlohmann::ordered_json;
+
+    auto frames = frames_.snapshot(window);
+    if (frames.empty()) {
+        return {};
+    }
+
+    double size = 0, decode = 0;
+    int64_t max_decode = 0;
+    for (const auto &f : frames) {
+        size += f.size;
+        decode += f.decode_us;
+        max_decode = std::max(max_decode, f.decode_us);
+    }
+
+    auto n = static_cast<double>(frames.size());
+    auto span_us = frames.back().decoded_time_us - frames.front().decoded_time_us;
+    json o = {
+        {"type", "decoder"},
+        {"frames", frames_.total()},
+        {"fps", span_us > 0 ? (n - 1) * 1e6 / span_us : 0.0},
+        {"width", frames.back().width},
+        {"height", frames.back().height},
+        {"threads", threads_.load()},
+        {"bytesPerFrame", size / n},
+        {"decodeMs", decode / n / 1000},
+        {"maxDecodeMs", max_decode / 1000.0},
+        {"concealedFrames", concealed_.load()},
+        {"keyFrameRequests", key_requests_.load()},
+    };
+    return o.dump(4);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "stats/ring_buffer.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// per frame telemetry of the custom decoders, written on the decoder thread
+// and read by the statistics view
+class DecoderStats
+{
+  public:
+    struct Frame {
+        uint32_t rtp_timestamp = 0;
+        int64_t decoded_time_us = 0;
+        int width = 0;
+        int height = 0;
+        size_t size = 0;
+        // Decode called -> frame received
+        int64_t decode_us = 0;
+    };
+
+    static constexpr size_t kCapacity = 4096;
+
+  public:
+    static DecoderStats &instance();
+
+    void add(const Frame &frame) { frames_.push(frame); }
+    // decoding threads of the latest opened decoder
+    void set_threads(int threads) { threads_ = threads; }
+    // a frame dropped because of a lost reference
+    void conceal() { concealed_++; }
+    void request_key_frame() { key_requests_++; }
+
+    // averages over the last `window` frames, as a json object
+    std::string summary(size_t window = 120) const;
+
+  private:
+    RingBuffer<Frame, kCapacity> frames_;
+    std::atomic<int> threads_ = 0;
+    std::atomic<uint64_t> concealed_ = 0;
+    std::atomic<uint64_t> key_requests_ = 0;
+};
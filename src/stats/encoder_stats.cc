@@ -0,0 +1,88 @@
+#include "encoder_stats.hh"
+#include "logger.hh"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <nlohmann/json.hpp>
+
+EncoderStats &EncoderStats::instance()
+{
+    static EncoderStats stats;
+    return stats;
+}
+
+std::string EncoderStats::summary(size_t window) const
+{
+    using json = nlohmann::ordered_json;
+
+    auto frames = frames_.snapshot(window);
+    if (frames.empty()) {
+        return {};
+    }
+
+    double qp = 0, size = 0, queue = 0, upload = 0, encode = 0, drain = 0;
+    size_t max_size = 0;
+    int qp_frames = 0, keyframes = 0;
+    for (const auto &f : frames) {
+        if (f.qp >= 0) {
+            qp += f.qp;
+            qp_frames++;
+        }
+        size += f.size;
+        max_size = std::max(max_size, f.size);
+        queue += f.queue_us;
+        upload += f.upload_us;
+        encode += f.encode_us;
+        drain += f.drain_us;
+        keyframes += f.keyframe;
+    }
+
+    auto n = static_cast<double>(frames.size());
+    auto span_us = frames.back().capture_time_us - frames.front().capture_time_us;
+    json o = {
+        {"type", "encoder"},
+        {"frames", frames_.total()},
+        {"fps", span_us > 0 ? (n - 1) * 1e6 / span_us : 0.0},
+        {"qp", qp_frames ? qp / qp_frames : -1.0},
+        {"bytesPerFrame", size / n},
+        // bursts, e.g. a window switch, in units of the mean frame size
+        {"maxToMeanSize", size > 0 ? max_size * n / size : 0.0},
+        {"keyFrames", keyframes},
+        {"queueMs", queue / n / 1000},
+        {"uploadMs", upload / n / 1000},
+        {"encodeMs", encode / n / 1000},
+        {"drainMs", drain / n / 1000},
+        {"dropped",
+         {
+             {"stale", drops(Drop::kStale)},
+             {"overBudget", drops(Drop::kOverBudget)},
+             {"busy", drops(Drop::kBusy)},
+         }},
+    };
+    return o.dump(4);
+}
+
+bool EncoderStats::dump(const std::string &path) const
+{
+    ::FILE *f = ::fopen(path.c_str(), "w");
+    if (!f) {
+        logger::error("failed to open encoder stats file: {}", path);
+        return false;
+    }
+
+    fprintf(f, "rtp_timestamp,capture_time_us,qp,size,keyframe,"
+               "queue_us,upload_us,encode_us,drain_us\n");
+    for (const auto &s : frames_.snapshot()) {
+        fprintf(f, "%u,%lld,%d,%zu,%d,%lld,%lld,%lld,%lld\n",
+                s.rtp_timestamp, static_cast<long long>(s.capture_time_us),
+                s.qp, s.size, s.keyframe,
+                static_cast<long long>(s.queue_us),
+                static_cast<long long>(s.upload_us),
+                static_cast<long long>(s.encode_us),
+                static_cast<long long>(s.drain_us));
+    }
+    fclose(f);
+    logger::info("encoder stats dumped to {}", path);
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "stats/ring_buffer.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// per frame telemetry of the custom encoders, written on the encoder queue
+// and read by the statistics view
+class EncoderStats
+{
+  public:
+    struct Frame {
+        uint32_t rtp_timestamp = 0;
+        int64_t capture_time_us = 0;
+        int qp = -1;
+        size_t size = 0;
+        bool keyframe = false;
+        // capture -> encode start
+        int64_t queue_us = 0;
+        // software frame -> hardware surface
+        int64_t upload_us = 0;
+        // avcodec_send_frame
+        int64_t encode_us = 0;
+        // avcodec_send_frame returned -> packet received
+        int64_t drain_us = 0;
+    };
+
+    // why a frame wasn't encoded
+    enum class Drop {
+        // waited too long in the encoder queue, newer frames are behind it
+        kStale,
+        // encoding is slower than the frame rate, skip to catch up
+        kOverBudget,
+        // the encoder didn't accept more input
+        kBusy,
+        kCount,
+    };
+
+    static constexpr size_t kCapacity = 4096;
+
+  public:
+    static EncoderStats &instance();
+
+    void add(const Frame &frame) { frames_.push(frame); }
+    void drop(Drop reason) { drops_[static_cast<size_t>(reason)]++; }
+    uint64_t drops(Drop reason) const
+    {
+        return drops_[static_cast<size_t>(reason)];
+    }
+    std::vector<Frame> frames(size_t max = kCapacity) const
+    {
+        return frames_.snapshot(max);
+    }
+
+    // averages over the last `window` frames, as a json object
+    std::string summary(size_t window = 120) const;
+    // all buffered frames as csv
+    bool dump(const std::string &path) const;
+
+  private:
+    RingBuffer<Frame, kCapacity> frames_;
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Drop::kCount)>
+        drops_{};
+};
@@ -0,0 +1,54 @@
+#include "render_stats.hh"
+
+#include <algorithm>
+#include <cmath>
+
+#include <nlohmann/json.hpp>
+
+RenderStats &RenderStats::instance()
+{
+    static RenderStats stats;
+    return stats;
+}
+
+std::string RenderStats::summary(size_t window) const
+{
+    using json = nlohmann::ordered_json;
+
+    auto frames = frames_.snapshot(window);
+    if (frames.size() < 2) {
+        return {};
+    }
+
+    // the first interval reaches back to a frame outside the window
+    double sum = 0, sq_sum = 0;
+    int64_t max_interval = 0, upload_sum = 0, max_upload = 0, bytes_sum = 0;
+    for (const auto &f : frames) {
+        upload_sum += f.upload_us;
+        bytes_sum += f.upload_bytes;
+        max_upload = std::max(max_upload, f.upload_us);
+    }
+    for (size_t i = 1; i < frames.size(); i++) {
+        auto v = static_cast<double>(frames[i].interval_us);
+        sum += v;
+        sq_sum += v * v;
+        max_interval = std::max(max_interval, frames[i].interval_us);
+    }
+
+    auto n = static_cast<double>(frames.size() - 1);
+    auto mean = sum / n;
+    json o = {
+        {"type", "render"},
+        {"frames", frames_.total()},
+        {"fps", mean > 0 ? 1e6 / mean : 0.0},
+        {"presentIntervalMs", mean / 1000},
+        // standard deviation of present-to-present intervals
+        {"jitterMs", std::sqrt(std::max(sq_sum / n - mean * mean, 0.0)) / 1000},
+        {"maxIntervalMs", max_interval / 1000.0},
+        {"uploadMs", upload_sum / 1000.0 / frames.size()},
+        {"maxUploadMs", max_upload / 1000.0},
+        {"uploadKBytes", bytes_sum / 1024.0 / frames.size()},
+        {"overwrittenFrames", overwritten_.load()},
+    };
+    return o.dump(4);
+}
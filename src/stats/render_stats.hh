@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stats/ring_buffer.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// per frame telemetry of the remote screen renderer, written on its render
+// thread and read by the statistics view
+class RenderStats
+{
+  public:
+    struct Frame {
+        // buffer swap returned
+        int64_t present_time_us = 0;
+        // since the previous present
+        int64_t interval_us = 0;
+        // CPU time and size of the texture upload, 0 if the renderer
+        // doesn't tell
+        int64_t upload_us = 0;
+        int64_t upload_bytes = 0;
+    };
+
+    static constexpr size_t kCapacity = 4096;
+
+  public:
+    static RenderStats &instance();
+
+    void add(const Frame &frame) { frames_.push(frame); }
+    // a frame was replaced by a newer one before it was presented
+    void overwrite() { overwritten_++; }
+
+    // averages over the last `window` frames, as a json object
+    std::string summary(size_t window = 120) const;
+
+  private:
+    RingBuffer<Frame, kCapacity> frames_;
+    std::atomic<uint64_t> overwritten_ = 0;
+};
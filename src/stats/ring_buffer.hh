@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Fixed size ring of trivially copyable records, writers never block and
+// never wait for readers, readers get a consistent copy of the most recent
+// records via a per-slot sequence lock.
+template <typename T, size_t N> class RingBuffer
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+  public:
+    void push(const T &v)
+    {
+        auto pos = head_.fetch_add(1, std::memory_order_relaxed);
+        auto &slot = slots_[pos & (N - 1)];
+        // odd sequence marks the slot as being written
+        slot.seq.store(pos * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.value = v;
+        slot.seq.store(pos * 2 + 2, std::memory_order_release);
+    }
+
+    // copy at most `max` of the latest records, oldest first
+    std::vector<T> snapshot(size_t max = N) const
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        auto n = std::min({max, N, static_cast<size_t>(head)});
+        std::vector<T> out;
+        out.reserve(n);
+        for (auto pos = head - n; pos < head; pos++) {
+            const auto &slot = slots_[pos & (N - 1)];
+            auto seq = slot.seq.load(std::memory_order_acquire);
+            T v = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // skip slots being written or already overwritten
+            if (seq != pos * 2 + 2 ||
+                slot.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            out.push_back(v);
+        }
+        return out;
+    }
+
+    uint64_t total() const { return head_.load(std::memory_order_relaxed); }
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> seq = 0;
+        T value;
+    };
+    std::atomic<uint64_t> head_ = 0;
+    std::array<Slot, N> slots_;
+};
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "logger.hh"
+#include "stats/decoder_stats.hh"
+#include "stats/encoder_stats.hh"
+#include "stats/render_stats.hh"
 
 #include <nlohmann/json.hpp>
 
@@ -25,6 +28,9 @@ class StatsObserver : public webrtc::RTCStatsCollectorCallback
 
         json_ = dump_section(json, "inbound-rtp");
         json_ += dump_section(json, "outbound-rtp");
+        json_ += EncoderStats::instance().summary();
+        json_ += DecoderStats::instance().summary();
+        json_ += RenderStats::instance().summary();
     }
 
     static std::string dump_section(const std::string &json,
@@ -0,0 +1,84 @@
+#include "encoder_stats.hh"
+#include "ring_buffer.hh"
+
+#include <cassert>
+#include <cstdio>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+static void test_ring_buffer()
+{
+    RingBuffer<int, 4> ring;
+    assert(ring.snapshot().empty());
+
+    for (int i = 1; i <= 5; i++) {
+        ring.push(i);
+    }
+    assert(ring.total() == 5);
+    assert((ring.snapshot() == std::vector<int>{2, 3, 4, 5}));
+    assert((ring.snapshot(2) == std::vector<int>{4, 5}));
+}
+
+static void test_ring_buffer_concurrent()
+{
+    struct Pair {
+        int64_t a;
+        int64_t b;
+    };
+    RingBuffer<Pair, 8> ring;
+    std::thread writer([&ring] {
+        for (int64_t i = 0; i < 100000; i++) {
+            ring.push({i, -i});
+        }
+    });
+    // torn records are skipped, never returned
+    while (ring.total() < 100000) {
+        for (const auto &p : ring.snapshot()) {
+            assert(p.a == -p.b);
+        }
+    }
+    writer.join();
+    assert(ring.snapshot().size() == 8);
+}
+
+static void test_encoder_stats_summary()
+{
+    auto &stats = EncoderStats::instance();
+    assert(stats.summary().empty());
+
+    // 2 intervals of 20 ms
+    stats.add({.capture_time_us = 0, .qp = 20, .size = 100, .keyframe = true,
+               .queue_us = 1000});
+    stats.add({.capture_time_us = 20000, .qp = 30, .size = 200,
+               .queue_us = 2000});
+    stats.add({.capture_time_us = 40000, .qp = -1, .size = 300,
+               .queue_us = 3000});
+    stats.drop(EncoderStats::Drop::kStale);
+
+    auto o = nlohmann::json::parse(stats.summary());
+    assert(o["frames"] == 3);
+    assert(o["fps"] == 50.0);
+    // frames without a QP don't count
+    assert(o["qp"] == 25.0);
+    assert(o["bytesPerFrame"] == 200.0);
+    assert(o["maxToMeanSize"] == 1.5);
+    assert(o["keyFrames"] == 1);
+    assert(o["queueMs"] == 2.0);
+    assert(o["dropped"]["stale"] == 1);
+    assert(o["dropped"]["busy"] == 0);
+
+    // only the latest frame
+    o = nlohmann::json::parse(stats.summary(1));
+    assert(o["fps"] == 0.0);
+    assert(o["qp"] == -1.0);
+}
+
+int main(int argc, char *argv[])
+{
+    test_ring_buffer();
+    test_ring_buffer_concurrent();
+    test_encoder_stats_summary();
+    std::printf("stats tests passed\n");
+    return 0;
+}
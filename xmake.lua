@@ -77,7 +77,7 @@ local function linux_options()
     add_defines('WEBRTC_POSIX', 'WEBRTC_LINUX', 'WEBRTC_USE_X11')
     add_links('glib-2.0', 'gobject-2.0', 'gio-2.0', 'gbm')
     add_links('X11', 'Xext', 'Xfixes', 'Xdamage', 'Xrandr', 'Xcomposite', 'Xtst')
-    add_links('rt', 'drm')
+    add_links('rt', 'drm', 'va', 'EGL')
 end
 
 local function add_vcpkg(...)
@@ -167,6 +167,40 @@ if get_config('buildtest') == 1 then
         end
     end)
 
+    target('stats_test', function()
+        set_kind('binary')
+        set_languages('c17', 'cxx20')
+        add_includedirs('src')
+        add_files('src/stats/stats_test.cc', 'src/stats/encoder_stats.cc')
+        add_vcpkg('spdlog', 'fmt', 'nlohmann-json')
+        if is_os('windows') then
+            windows_options()
+        end
+    end)
+
+    -- small tests of code depending on webrtc only
+    local function webrtc_test(name, ...)
+        target(name, function()
+            set_kind('binary')
+            set_languages('c17', 'cxx20')
+            add_cxxflags('-Wno-deprecated-declarations')
+            add_includedirs('src', webrtc_src_dir)
+            add_files(...)
+            add_vcpkg('spdlog', 'fmt', 'libyuv')
+            add_linkdirs(webrtc_obj_dir)
+            add_links('webrtc')
+            if is_os('linux') then
+                linux_options()
+            end
+            if is_os('windows') then
+                windows_options()
+            end
+        end)
+    end
+    webrtc_test('dirty_rects_test', 'src/codec/dirty_rects*.cc')
+    webrtc_test('passthrough_test', 'src/codec/encoder/passthrough*.cc')
+    webrtc_test('tile_source_test', 'src/source/tile_source*.cc')
+
     if is_os('windows') then
         target('executor_test', function()
             set_kind('binary')